@@ -0,0 +1,332 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Runs a corpus of channel scripts through the JS module's own run path, sandbox_run(): pooled
+ * heaps with the sandbox allocators and quota accounting, a fresh global environment per run,
+ * the binding dispatcher and profiler hooks, the injected message variables, bytecode caching
+ * and the execution timeout hook. The key/value bindings use the module's KVCache over a
+ * stand-in database, and only the bindings which would talk to Discord are replaced.
+ *
+ * For each script it reports compile time, bytecode load time, execution time, allocations
+ * and peak sandbox memory, then the throughput of the whole corpus for 1, 2, 4 and 8 workers.
+ * Results are written to stdout as JSON, so runs before and after a Duktape upgrade or a
+ * sandbox change can be compared by a script.
+ *
+ * Usage: bench_js_sandbox [runs per script, default 200] [runs per throughput test, default 2000]
+ *
+ ************************************************************************************/
+
+#include "duktape.h"
+#include "heappool.h"
+#include "workerpool.h"
+#include "kvcache.h"
+#include "sandbox.h"
+#include <nlohmann/json.hpp>
+#include <chrono>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <iostream>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+using json = nlohmann::json;
+
+/* See mock_database.cpp */
+uint64_t mock_statements();
+
+/* The voted quotas, so that no script in the corpus is cut short */
+const size_t limit = 512 * 1024;
+const uint64_t timeout_ms = 20;
+
+/* Distinct channels the throughput runs are spread over */
+const uint64_t channels = 64;
+
+/* Worker counts the throughput test is run with */
+const size_t worker_counts[] = { 1, 2, 4, 8 };
+
+struct bench_script {
+	const char* name;
+	const char* source;
+};
+
+/* Representative channel scripts. Each replies at most once, as real scripts are limited to a few messages per run. */
+const bench_script scripts[] = {
+	{ "string",
+		"var words = message.content.split(' '); var out = '';"
+		"for (var i = 0; i < 300; i++) { out += words[i % words.length].toUpperCase() + (i % 10 == 9 ? '\\n' : ' '); }"
+		"var counts = {}; for (var i = 0; i < out.length; i++) { var c = out.charAt(i); counts[c] = (counts[c] || 0) + 1; }"
+		"if (out.indexOf('FOX') >= 0) { create_message(CHANNEL_ID, out.substr(0, 200)); }" },
+	{ "json",
+		"var doc = { author: author, message: message, items: [] };"
+		"for (var i = 0; i < 40; i++) { doc.items.push({ id: i, name: 'item' + i, tags: ['a', 'b', 'c'], score: i * 1.5 }); }"
+		"var s = ''; for (var i = 0; i < 20; i++) { s = JSON.stringify(JSON.parse(JSON.stringify(doc))); }"
+		"create_message(CHANNEL_ID, 'size ' + s.length);" },
+	{ "kv",
+		"var n = parseInt(load('counter') || '0') + 1; save('counter', '' + n);"
+		"var seen = JSON.parse(load('seen:' + author.id) || '[]'); seen.push(message.id); if (seen.length > 20) { seen.shift(); }"
+		"save('seen:' + author.id, JSON.stringify(seen));"
+		"for (var i = 0; i < 10; i++) { save('tmp' + i, 'x' + i); load('tmp' + i); delete('tmp' + i); }"
+		"create_message(CHANNEL_ID, author.username + ' has been seen ' + seen.length + ' times, ' + n + ' messages total');" },
+	{ "embed",
+		"var u = find_user(author.id); var fields = [];"
+		"for (var i = 0; i < 10; i++) { fields.push({ name: 'Field ' + i, value: u.username + ' ' + i, inline: (i % 2 == 0) }); }"
+		"var embed = { title: 'Profile of ' + u.username, color: 0x00ff00, description: message.content, fields: fields,"
+		" footer: { text: 'Requested by ' + author.username }, thumbnail: { url: 'https://cdn.example.com/' + u.avatar + '.png' } };"
+		"create_message(CHANNEL_ID, JSON.stringify(embed));" },
+};
+
+/* The per-message variables, as the JS module injects them */
+const char* message_vars[][2] = {
+	{ "message", "{\"id\":\"700000000000000001\",\"content\":\"the quick brown fox jumps over the lazy dog\",\"channel_id\":\"600000000000000001\",\"mentions\":[]}" },
+	{ "author", "{\"id\":\"500000000000000001\",\"username\":\"someone\",\"discriminator\":\"1234\",\"avatar\":\"0123456789abcdef\",\"bot\":false}" },
+};
+
+/* Total size of the messages scripts have sent */
+std::atomic<uint64_t> message_bytes(0);
+
+static duk_ret_t stub_create_message(duk_context* cx)
+{
+	sandbox_context* c = sandbox_get_context(cx);
+	c->message_total++;
+	message_bytes += strlen(duk_safe_to_string(cx, 1));
+	return 0;
+}
+
+static duk_ret_t stub_find_user(duk_context* cx)
+{
+	std::string id = duk_safe_to_string(cx, 0);
+	duk_push_object(cx);
+	duk_push_string(cx, id.c_str());
+	duk_put_prop_string(cx, -2, "id");
+	duk_push_string(cx, "someone");
+	duk_put_prop_string(cx, -2, "username");
+	duk_push_string(cx, "1234");
+	duk_put_prop_string(cx, -2, "discriminator");
+	duk_push_string(cx, "0123456789abcdef");
+	duk_put_prop_string(cx, -2, "avatar");
+	duk_push_string(cx, ("<@" + id + ">").c_str());
+	duk_put_prop_string(cx, -2, "mention");
+	duk_push_boolean(cx, 0);
+	duk_put_prop_string(cx, -2, "bot");
+	return 1;
+}
+
+/* The sandbox's own bindings, and stand-ins for those used by the corpus which would talk to Discord */
+const sandbox_binding bindings[] = {
+	{ "debuglog", sandbox_debuglog, DUK_VARARGS },
+	{ "find_user", stub_find_user, 1 },
+	{ "create_message", stub_create_message, DUK_VARARGS },
+	{ "save", sandbox_save, 2 },
+	{ "load", sandbox_load, 1 },
+	{ "delete", sandbox_delete, 1 },
+	{ "exit", sandbox_exit, 1 },
+};
+
+/* The measurements of one run */
+struct run_result {
+	bool ok;
+	double compile_ms;
+	double load_ms;
+	double exec_ms;
+	uint64_t allocations;
+	uint64_t allocated_bytes;
+	size_t memory;
+};
+
+/* The per-message variables, parsed once as the bot builds its variables as json before a run is queued */
+static const std::unordered_map<std::string, json>& run_vars()
+{
+	static const std::unordered_map<std::string, json> vars = []() {
+		std::unordered_map<std::string, json> v;
+		for (size_t i = 0; i < sizeof(message_vars) / sizeof(message_vars[0]); ++i) {
+			v[message_vars[i][0]] = json::parse(message_vars[i][1]);
+		}
+		return v;
+	}();
+	return vars;
+}
+
+/**
+ * One run of a script on a heap from the pool, set up as JS::run() sets it up. If compile is set
+ * the cached bytecode is dropped first, so the run compiles the source as a changed script's
+ * first run would, and its compile_ms is the compile time rather than the bytecode load time.
+ */
+run_result run_script(HeapPool &heaps, KVCache &kv, uint64_t channel_id, sandbox_script &script, bool compile)
+{
+	run_result r = {};
+	sandbox_context context = {};
+	context.channel_id = channel_id;
+	context.guild_id = channel_id;
+	context.bot_id = 1;
+	context.kv = &kv;
+	context.bindings = bindings;
+	context.binding_count = sizeof(bindings) / sizeof(bindings[0]);
+
+	sandbox_heap* heap = heaps.Acquire(limit);
+	if (!heap) {
+		return r;
+	}
+	heap->context = &context;
+	heap->timer.timeout = timeout_ms;
+
+	if (compile) {
+		script.bytecode.clear();
+	}
+	js_run stats = {};
+	r.ok = sandbox_run(heap, script, run_vars(), "", "", stats);
+	if (compile) {
+		r.compile_ms = stats.compile_ms;
+	} else {
+		r.load_ms = stats.compile_ms;
+	}
+	r.exec_ms = stats.exec_ms;
+	if (!r.ok) {
+		fprintf(stderr, "Script %s failed: %s\n", script.name.c_str(), stats.error.c_str());
+	}
+	r.allocations = heap->allocations;
+	r.allocated_bytes = heap->allocated_bytes;
+	r.memory = stats.memory;
+	heap->context = nullptr;
+	heaps.Release(heap);
+	return r;
+}
+
+static double percentile(std::vector<double> v, size_t pct)
+{
+	if (v.empty()) {
+		return 0;
+	}
+	auto p = v.begin() + std::min(v.size() - 1, (v.size() * pct) / 100);
+	std::nth_element(v.begin(), p, v.end());
+	return *p;
+}
+
+int main(int argc, char** argv)
+{
+	int runs = argc > 1 ? std::max(1, atoi(argv[1])) : 200;
+	int throughput_runs = argc > 2 ? std::max(1, atoi(argv[2])) : 2000;
+	const size_t script_count = sizeof(scripts) / sizeof(scripts[0]);
+
+	sandbox_log = spdlog::stderr_color_mt("bench");
+	sandbox_log->set_level(spdlog::level::warn);
+
+	HeapPool heaps(sandbox_alloc, sandbox_realloc, sandbox_free, sandbox_fatal);
+	KVCache kv;
+
+	/* Each channel has its own copy of each script, compiled once as the module does when a script
+	 * is loaded. As in the bot, a channel's copy is only ever touched by that channel's worker.
+	 */
+	std::vector<std::unique_ptr<sandbox_script>> programs;
+	for (uint64_t c = 0; c < channels; ++c) {
+		for (size_t s = 0; s < script_count; ++s) {
+			programs.emplace_back(new sandbox_script());
+			sandbox_script &p = *programs.back();
+			p.name = scripts[s].name;
+			p.source = scripts[s].source;
+			p.profiling = false;
+			sandbox_heap* heap = heaps.Acquire(limit);
+			if (!heap || !sandbox_compile(heap, p)) {
+				fprintf(stderr, "Script %s doesn't compile: %s\n", p.name.c_str(), p.compile_error.c_str());
+				return 1;
+			}
+			heaps.Release(heap);
+		}
+	}
+	auto program = [&programs, script_count](uint64_t channel_id, size_t s) -> sandbox_script& {
+		return *programs[(channel_id - 1) * script_count + s];
+	};
+
+	json results = {
+		{ "duktape_version", DUK_VERSION },
+		{ "runs", runs },
+		{ "scripts", json::array() },
+		{ "throughput", json::array() }
+	};
+
+	for (size_t s = 0; s < script_count; ++s) {
+		std::vector<double> compile, load, exec;
+		uint64_t allocations = 0, allocated_bytes = 0, failures = 0;
+		size_t memory = 0;
+		/* One run to warm the heap pool and caches */
+		run_script(heaps, kv, 1, program(1, s), false);
+		for (int r = 0; r < runs; ++r) {
+			uint64_t channel_id = 1 + (r % channels);
+			/* A run which compiles, as after a script changes, then one from the cached bytecode */
+			run_result compiled = run_script(heaps, kv, channel_id, program(channel_id, s), true);
+			run_result rr = run_script(heaps, kv, channel_id, program(channel_id, s), false);
+			failures += (compiled.ok ? 0 : 1) + (rr.ok ? 0 : 1);
+			compile.push_back(compiled.compile_ms);
+			load.push_back(rr.load_ms);
+			exec.push_back(rr.exec_ms);
+			allocations += rr.allocations;
+			allocated_bytes += rr.allocated_bytes;
+			memory = std::max(memory, rr.memory);
+		}
+		results["scripts"].push_back({
+			{ "name", scripts[s].name },
+			{ "failures", failures },
+			{ "compile_ms", { { "p50", percentile(compile, 50) }, { "p95", percentile(compile, 95) } } },
+			{ "load_ms", { { "p50", percentile(load, 50) }, { "p95", percentile(load, 95) } } },
+			{ "exec_ms", { { "p50", percentile(exec, 50) }, { "p95", percentile(exec, 95) } } },
+			{ "allocations_per_run", allocations / runs },
+			{ "allocated_bytes_per_run", allocated_bytes / runs },
+			{ "peak_memory", memory }
+		});
+	}
+
+	/* The whole corpus round robin, spread over channels, with one channel's runs always on the same worker as in the bot */
+	for (size_t w = 0; w < sizeof(worker_counts) / sizeof(worker_counts[0]); ++w) {
+		std::atomic<uint64_t> failures(0);
+		auto start = std::chrono::steady_clock::now();
+		{
+			WorkerPool workers(worker_counts[w]);
+			for (int r = 0; r < throughput_runs; ++r) {
+				uint64_t channel_id = 1 + (r % channels);
+				size_t s = r % script_count;
+				workers.Submit(channel_id, [&heaps, &kv, &failures, &program, channel_id, s]() {
+					if (!run_script(heaps, kv, channel_id, program(channel_id, s), false).ok) {
+						failures++;
+					}
+				});
+			}
+			/* Waits for every queued run */
+		}
+		double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		results["throughput"].push_back({
+			{ "workers", worker_counts[w] },
+			{ "runs", throughput_runs },
+			{ "failures", failures.load() },
+			{ "seconds", secs },
+			{ "runs_per_sec", throughput_runs / secs }
+		});
+	}
+
+	results["message_bytes"] = message_bytes.load();
+	results["db_statements"] = mock_statements();
+	results["heaps_created"] = heaps.Created();
+	results["heaps_reused"] = heaps.Reused();
+	std::cout << results.dump(1) << "\n";
+	return 0;
+}
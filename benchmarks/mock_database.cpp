@@ -0,0 +1,82 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Stands in for the database in benchmarks. Every statement succeeds, and queries return no
+ * rows, so code using the database runs its normal path without a MySQL server.
+ *
+ ************************************************************************************/
+
+#include <sporks/database.h>
+#include <atomic>
+
+namespace db {
+
+	static std::atomic<uint64_t> statements(0);
+	static const std::string no_error;
+
+	bool connect(const std::string &host, const std::string &user, const std::string &pass, const std::string &db, int port)
+	{
+		return true;
+	}
+
+	bool close()
+	{
+		return true;
+	}
+
+	resultset query(const std::string &format, const paramlist &parameters)
+	{
+		statements++;
+		return resultset();
+	}
+
+	bool query(const std::string &format, const paramlist &parameters, resultset &results)
+	{
+		statements++;
+		results.clear();
+		return true;
+	}
+
+	bool execute(const std::string &format, const paramlist &parameters)
+	{
+		statements++;
+		return true;
+	}
+
+	bool query_each(const std::string &format, const paramlist &parameters, const row_callback &callback)
+	{
+		statements++;
+		return true;
+	}
+
+	const std::string& error()
+	{
+		return no_error;
+	}
+
+	bool transient_error()
+	{
+		return false;
+	}
+};
+
+/* Number of statements the code being benchmarked has issued */
+uint64_t mock_statements()
+{
+	return db::statements;
+}
@@ -0,0 +1,108 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Compares libc rand() against the per-thread generator in rng::, and the cost
+ * of the atomic infobot counters, as the number of threads increases. rand()
+ * serialises every caller on a lock inside libc, so its cost per call climbs
+ * with the thread count where rng::next() stays flat. The shared atomic counter
+ * is shown against a plain per-thread increment as the uncontended baseline,
+ * and against a counter sharded across cache lines and summed on read.
+ *
+ ************************************************************************************/
+
+#include <sporks/random.h>
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <cstdlib>
+#include <cstdio>
+
+const uint64_t iterations = 2000000;
+
+/* Stops the optimiser throwing away the generated numbers */
+std::atomic<uint64_t> sink;
+
+std::atomic<uint64_t> shared_counter;
+
+/* One slot per thread, each on its own cache line so threads never share a line */
+const unsigned int counter_shards = 64;
+struct alignas(64) counter_shard {
+	std::atomic<uint64_t> n;
+};
+counter_shard sharded_counter[counter_shards];
+std::atomic<unsigned int> next_shard;
+thread_local unsigned int my_shard = next_shard++ % counter_shards;
+
+uint64_t sharded_total()
+{
+	uint64_t total = 0;
+	for (auto & s : sharded_counter) {
+		total += s.n.load(std::memory_order_relaxed);
+	}
+	return total;
+}
+
+/**
+ * Run a function on n threads at once, returning the mean nanoseconds per call
+ */
+double run_threads(int n, const std::function<uint64_t()> &fn)
+{
+	std::vector<std::thread> threads;
+	std::atomic<bool> go(false);
+	auto start = std::chrono::steady_clock::now();
+	for (int t = 0; t < n; ++t) {
+		threads.emplace_back([&]() {
+			uint64_t local = 0;
+			while (!go) {
+				std::this_thread::yield();
+			}
+			for (uint64_t i = 0; i < iterations; ++i) {
+				local += fn();
+			}
+			sink += local;
+		});
+	}
+	start = std::chrono::steady_clock::now();
+	go = true;
+	for (auto & t : threads) {
+		t.join();
+	}
+	double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	return elapsed / (double)iterations;
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int max_threads = std::max(1u, std::thread::hardware_concurrency());
+	srand(time(NULL));
+
+	printf("%-8s %16s %16s %16s %16s %16s\n", "threads", "rand() ns/op", "rng ns/op", "local++ ns/op", "atomic++ ns/op", "sharded++ ns/op");
+	for (unsigned int n = 1; n <= max_threads; n *= 2) {
+		double libc = run_threads(n, []() -> uint64_t { return rand(); });
+		double ours = run_threads(n, []() -> uint64_t { return rng::next(); });
+		double local = run_threads(n, []() -> uint64_t { static thread_local uint64_t c = 0; return ++c; });
+		double counter = run_threads(n, []() -> uint64_t { return shared_counter++; });
+		double sharded = run_threads(n, []() -> uint64_t { return sharded_counter[my_shard].n.fetch_add(1, std::memory_order_relaxed); });
+		printf("%-8u %16.2f %16.2f %16.2f %16.2f %16.2f\n", n, libc, ours, local, counter, sharded);
+	}
+	printf("sharded counter total: %lu\n", (unsigned long)sharded_total());
+	return 0;
+}
@@ -0,0 +1,322 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Compares the JS sandbox's arena allocator against the malloc() based allocator it
+ * replaced. Both do the same quota accounting, so the difference is the cost of getting
+ * the memory.
+ *
+ * First the same scripts are run on fresh Duktape heaps backed by each, including heap
+ * creation and teardown. As that time is mostly spent interpreting, the allocation calls
+ * made by one run are also recorded and replayed against each allocator on their own,
+ * which gives the allocation rate.
+ *
+ ************************************************************************************/
+
+#include "duktape.h"
+#include "timeout.h"
+#include "arena.h"
+#include <chrono>
+#include <algorithm>
+#include <vector>
+#include <unordered_map>
+#include <cstdlib>
+#include <cstdio>
+
+const int runs = 500;
+
+/* Times the recorded allocation trace is replayed */
+const int replays = 200;
+
+/* The largest quota a script can have */
+const size_t limit = 512 * 1024;
+
+/* Scripts in the style of real channel scripts: string building, small objects and arrays, JSON */
+const char* scripts[] = {
+	"var out = ''; for (var i = 0; i < 200; i++) { out += 'line ' + i + '\\n'; } out.length;",
+	"var a = []; for (var i = 0; i < 500; i++) { a.push({ id: i, name: 'user' + i, tags: ['x', 'y'] }); } a.filter(function(o) { return o.id % 3 == 0; }).length;",
+	"var o = { message: { content: 'hello world', author: { id: '123', username: 'someone' } }, list: [1,2,3,4,5] };"
+		"var s = ''; for (var i = 0; i < 100; i++) { s = JSON.stringify(JSON.parse(JSON.stringify(o))); } s.length;",
+	"var words = 'the quick brown fox jumps over the lazy dog'.split(' '); var m = {};"
+		"for (var i = 0; i < 2000; i++) { var w = words[i % words.length]; m[w] = (m[w] || 0) + 1; } Object.keys(m).length;",
+};
+
+/* The heap udata. Starts with the timer, as check_exec_timeout() expects. */
+struct bench_heap {
+	sandbox_timer timer;
+	size_t allocated;
+	uint64_t calls;
+	SandboxArena* arena;
+};
+
+/* One recorded allocator call. Pointers are replaced by the index of the call which returned them. */
+struct trace_op {
+	enum { op_alloc, op_realloc, op_free } type;
+	size_t size;
+	size_t target;
+};
+
+std::vector<trace_op> trace;
+std::unordered_map<void*, size_t> live;
+
+/* Calls whose result was still allocated at the end of the trace */
+std::vector<size_t> survivors;
+
+/* The previous allocator: malloc() every allocation with a header holding its size */
+union alloc_hdr {
+	size_t sz;
+	double d;
+};
+
+void* malloc_alloc(void* udata, duk_size_t size)
+{
+	bench_heap* h = (bench_heap*)udata;
+	h->calls++;
+	if (size == 0 || h->allocated + size > limit) {
+		return NULL;
+	}
+	alloc_hdr* hdr = (alloc_hdr*)malloc(size + sizeof(alloc_hdr));
+	if (!hdr) {
+		return NULL;
+	}
+	hdr->sz = size;
+	h->allocated += size;
+	return (void*)(hdr + 1);
+}
+
+void malloc_free(void* udata, void* ptr)
+{
+	bench_heap* h = (bench_heap*)udata;
+	h->calls++;
+	if (!ptr) {
+		return;
+	}
+	alloc_hdr* hdr = ((alloc_hdr*)ptr) - 1;
+	h->allocated -= hdr->sz;
+	free((void*)hdr);
+}
+
+void* malloc_realloc(void* udata, void* ptr, duk_size_t size)
+{
+	bench_heap* h = (bench_heap*)udata;
+	if (!ptr) {
+		return malloc_alloc(udata, size);
+	}
+	h->calls++;
+	alloc_hdr* hdr = ((alloc_hdr*)ptr) - 1;
+	size_t old_size = hdr->sz;
+	if (size == 0) {
+		h->allocated -= old_size;
+		free((void*)hdr);
+		return NULL;
+	}
+	if (h->allocated - old_size + size > limit) {
+		return NULL;
+	}
+	hdr = (alloc_hdr*)realloc((void*)hdr, size + sizeof(alloc_hdr));
+	if (!hdr) {
+		return NULL;
+	}
+	h->allocated = h->allocated - old_size + size;
+	hdr->sz = size;
+	return (void*)(hdr + 1);
+}
+
+void* arena_alloc(void* udata, duk_size_t size)
+{
+	bench_heap* h = (bench_heap*)udata;
+	h->calls++;
+	if (size == 0 || h->allocated + size > limit) {
+		return NULL;
+	}
+	void* ptr = h->arena->Alloc(size);
+	if (ptr) {
+		h->allocated += size;
+	}
+	return ptr;
+}
+
+void arena_free(void* udata, void* ptr)
+{
+	bench_heap* h = (bench_heap*)udata;
+	h->calls++;
+	if (!ptr) {
+		return;
+	}
+	h->allocated -= SandboxArena::Size(ptr);
+	h->arena->Free(ptr);
+}
+
+void* arena_realloc(void* udata, void* ptr, duk_size_t size)
+{
+	bench_heap* h = (bench_heap*)udata;
+	if (!ptr) {
+		return arena_alloc(udata, size);
+	}
+	h->calls++;
+	size_t old_size = SandboxArena::Size(ptr);
+	if (size == 0) {
+		h->allocated -= old_size;
+		h->arena->Free(ptr);
+		return NULL;
+	}
+	if (h->allocated - old_size + size > limit) {
+		return NULL;
+	}
+	void* t = h->arena->Realloc(ptr, size);
+	if (t) {
+		h->allocated = h->allocated - old_size + size;
+	}
+	return t;
+}
+
+void* record_alloc(void* udata, duk_size_t size)
+{
+	void* ptr = malloc_alloc(udata, size);
+	if (ptr) {
+		live[ptr] = trace.size();
+	}
+	trace.push_back({ trace_op::op_alloc, size, 0 });
+	return ptr;
+}
+
+void record_free(void* udata, void* ptr)
+{
+	if (ptr) {
+		trace.push_back({ trace_op::op_free, 0, live[ptr] });
+		live.erase(ptr);
+	}
+	malloc_free(udata, ptr);
+}
+
+void* record_realloc(void* udata, void* ptr, duk_size_t size)
+{
+	if (!ptr) {
+		return record_alloc(udata, size);
+	}
+	size_t target = live[ptr];
+	live.erase(ptr);
+	void* moved = malloc_realloc(udata, ptr, size);
+	if (moved) {
+		live[moved] = trace.size();
+	}
+	trace.push_back({ trace_op::op_realloc, size, target });
+	return moved;
+}
+
+void fatal(void* udata, const char* msg)
+{
+	fprintf(stderr, "Duktape fatal error: %s\n", msg);
+	abort();
+}
+
+/**
+ * Run every script on a new heap, runs times over. Returns the mean microseconds per run.
+ */
+double bench(bool use_arena, uint64_t &calls, size_t &reserved)
+{
+	calls = reserved = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (int r = 0; r < runs; ++r) {
+		bench_heap h = {};
+		h.timer.timeout = 1000;
+		gettimeofday(&h.timer.start, NULL);
+		SandboxArena arena;
+		h.arena = &arena;
+		duk_context* ctx = use_arena ?
+			duk_create_heap(arena_alloc, arena_realloc, arena_free, (void*)&h, fatal) :
+			duk_create_heap(malloc_alloc, malloc_realloc, malloc_free, (void*)&h, fatal);
+		for (size_t s = 0; s < sizeof(scripts) / sizeof(scripts[0]); ++s) {
+			if (duk_peval_string(ctx, scripts[s]) != 0) {
+				fprintf(stderr, "Script %lu failed: %s\n", (unsigned long)s, duk_safe_to_string(ctx, -1));
+			}
+			duk_pop(ctx);
+		}
+		reserved = std::max(reserved, arena.Reserved());
+		duk_destroy_heap(ctx);
+		calls += h.calls;
+	}
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / (double)runs;
+}
+
+/**
+ * Replay the recorded trace through an allocator, replays times over. Returns the mean nanoseconds per call.
+ */
+double replay(duk_alloc_function alloc, duk_realloc_function realloc_fn, duk_free_function free_fn)
+{
+	std::vector<void*> results(trace.size());
+	auto start = std::chrono::steady_clock::now();
+	for (int r = 0; r < replays; ++r) {
+		bench_heap h = {};
+		SandboxArena arena;
+		h.arena = &arena;
+		for (size_t i = 0; i < trace.size(); ++i) {
+			switch (trace[i].type) {
+				case trace_op::op_alloc:
+					results[i] = alloc((void*)&h, trace[i].size);
+				break;
+				case trace_op::op_realloc:
+					results[i] = realloc_fn((void*)&h, results[trace[i].target], trace[i].size);
+				break;
+				case trace_op::op_free:
+					free_fn((void*)&h, results[trace[i].target]);
+				break;
+			}
+		}
+		/* Heap destruction */
+		for (size_t i = 0; i < survivors.size(); ++i) {
+			free_fn((void*)&h, results[survivors[i]]);
+		}
+	}
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / ((double)replays * trace.size());
+}
+
+int main(int argc, char** argv)
+{
+	uint64_t calls;
+	size_t reserved;
+
+	/* Warm up malloc() and the caches */
+	bench(false, calls, reserved);
+
+	double with_malloc = bench(false, calls, reserved);
+	double with_arena = bench(true, calls, reserved);
+
+	/* Record the allocator calls of one complete run */
+	bench_heap h = {};
+	h.timer.timeout = 1000;
+	gettimeofday(&h.timer.start, NULL);
+	duk_context* ctx = duk_create_heap(record_alloc, record_realloc, record_free, (void*)&h, fatal);
+	for (size_t s = 0; s < sizeof(scripts) / sizeof(scripts[0]); ++s) {
+		duk_peval_string(ctx, scripts[s]);
+		duk_pop(ctx);
+	}
+	duk_destroy_heap(ctx);
+	for (auto i = live.begin(); i != live.end(); ++i) {
+		survivors.push_back(i->second);
+	}
+
+	double malloc_ns = replay(malloc_alloc, malloc_realloc, malloc_free);
+	double arena_ns = replay(arena_alloc, arena_realloc, arena_free);
+
+	printf("%lu allocator calls per run\n\n", (unsigned long)(calls / runs));
+	printf("%-10s %14s %18s %16s\n", "allocator", "us/run", "replay ns/call", "Mcalls/sec");
+	printf("%-10s %14.2f %18.2f %16.2f\n", "malloc", with_malloc, malloc_ns, 1000.0 / malloc_ns);
+	printf("%-10s %14.2f %18.2f %16.2f\n", "arena", with_arena, arena_ns, 1000.0 / arena_ns);
+	printf("\nArena peak reserved from malloc(): %lu bytes\n", (unsigned long)reserved);
+	return 0;
+}
@@ -43,6 +43,9 @@
 #include <thread>
 #include <tuple>
 #include <unordered_map>
+#include <sporks/voters.h>
+#include <sporks/nameindex.h>
+#include <sporks/counters.h>
 
 using json = nlohmann::json;
 
@@ -78,7 +81,13 @@ public:
 	aegis::core &core;
 
 	/* Generic named counters */
-	std::map<std::string, uint64_t> counters;
+	Counters counters;
+
+	/* Users with a current vote, kept up to date by the voting module */
+	VoterIndex voters;
+
+	/* Member and channel names of every guild, kept up to date by guild events */
+	NameIndex names;
 
 	/* The bot's user details from ready event */
 	aegis::gateway::objects::user user;
@@ -0,0 +1,49 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <string>
+#include <map>
+#include <mutex>
+#include <cstdint>
+
+/**
+ * Named counters and gauges which modules publish for diagnostics and the status embed.
+ * They are set from module worker threads and read from message handlers, so every access
+ * goes through a mutex. A counter which has never been set reads as zero.
+ */
+class Counters {
+
+	std::map<std::string, uint64_t> values;
+	std::mutex counters_mutex;
+
+public:
+	/* Set a counter to a new value, creating it if needed */
+	void Set(const std::string &name, uint64_t value);
+
+	/* Add to a counter, creating it if needed, and return the new value */
+	uint64_t Add(const std::string &name, uint64_t value);
+
+	/* Current value of a counter, or zero if it has never been set */
+	uint64_t Get(const std::string &name);
+
+	/* True if a counter has been set, e.g. because the module which sets it is loaded */
+	bool Has(const std::string &name);
+};
@@ -23,6 +23,7 @@
 #include <map>
 #include <string>
 #include <variant>
+#include <functional>
 
 /*
  * db::resultset r = db::query("SELECT * FROM infobot WHERE setby = '?'", {"SKIPDX00"});
@@ -41,12 +42,25 @@ namespace db {
 
 	typedef std::vector<std::variant<float, std::string, uint64_t, int64_t, bool, int32_t, uint32_t, double>> paramlist;
 
+	/* Called once per row by query_each(), return false to stop reading rows */
+	typedef std::function<bool(const row&)> row_callback;
+
 	/* Connect to database */
 	bool connect(const std::string &host, const std::string &user, const std::string &pass, const std::string &db, int port);
 	/* Disconnect from database */
 	bool close();
 	/* Issue a database query and return results */
 	resultset query(const std::string &format, const paramlist &parameters);
-	/* Returns the last error string */
+	/* Issue a database query into a resultset, returns false if the query failed */
+	bool query(const std::string &format, const paramlist &parameters, resultset &results);
+	/* Issue a database query whose rows (if any) aren't wanted, returns false if it failed */
+	bool execute(const std::string &format, const paramlist &parameters);
+	/* Issue a database query and stream the results through a callback, one row at a time */
+	bool query_each(const std::string &format, const paramlist &parameters, const row_callback &callback);
+	/* Returns the error of the last query made by the calling thread, or an empty string */
 	const std::string& error();
+	/* True if the calling thread's last query failed for a reason which may go away if it is retried,
+	 * such as a lost connection or a deadlock, rather than because the server rejected the query.
+	 */
+	bool transient_error();
 };
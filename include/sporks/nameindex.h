@@ -0,0 +1,110 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <string>
+#include <vector>
+#include <tuple>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+
+/**
+ * In-memory index of member and channel names for every guild the bot can see, so that a
+ * name can be turned into snowflake ids with a hash lookup instead of walking every member
+ * of the guild and lowercasing each of their names. Names are case folded with lowercase().
+ *
+ * Members are indexed both by their full name (username#discriminator) and by their bare
+ * username, as more than one member of a guild can share a username. The index is kept up
+ * to date by the Bot's guild, member and channel events, before any module sees them.
+ *
+ * Names are not stored, only a 64 bit hash of each case folded name, as aegis already holds
+ * the names themselves. Lookups return ids only, and a hash collision could in principle add
+ * an unrelated id, so callers should still resolve the ids through aegis, which is the
+ * authority on what a member or channel is currently called.
+ */
+class NameIndex {
+
+	/* Hashes of the names a member is indexed under, needed to unindex them on rename or removal */
+	struct member_names {
+		uint64_t full_name;
+		uint64_t username;
+	};
+
+	struct guild_names {
+		std::unordered_map<int64_t, member_names> members;
+		std::unordered_multimap<uint64_t, int64_t> by_full_name;
+		std::unordered_multimap<uint64_t, int64_t> by_username;
+		std::unordered_map<int64_t, uint64_t> channels;
+		std::unordered_multimap<uint64_t, int64_t> by_channel_name;
+	};
+
+	std::unordered_map<int64_t, guild_names> guilds;
+	std::mutex names_mutex;
+
+	/* Hash of a name, case folded */
+	static uint64_t Hash(const std::string &name);
+
+	/* Remove one (name hash, id) pair from a multimap */
+	static void Unlink(std::unordered_multimap<uint64_t, int64_t> &map, uint64_t name, int64_t id);
+
+	/* Collect every id indexed under a name, returns false if there are none */
+	static bool Collect(const std::unordered_multimap<uint64_t, int64_t> &map, const std::string &name, std::vector<int64_t> &ids);
+
+	/* Add or rename within one guild. Caller must hold names_mutex if g is in the index */
+	static void AddMemberLocked(guild_names &g, int64_t member_id, const std::string &username, const std::string &discriminator);
+	static void AddChannelLocked(guild_names &g, int64_t channel_id, const std::string &name);
+
+public:
+	/* Index a guild from its guild create, replacing anything already known about it.
+	 * Members are (id, username, discriminator) and channels are (id, name).
+	 */
+	void AddGuild(int64_t guild_id, const std::vector<std::tuple<int64_t, std::string, std::string>> &members, const std::vector<std::pair<int64_t, std::string>> &channels);
+
+	/* Forget a guild entirely */
+	void RemoveGuild(int64_t guild_id);
+
+	/* Add or rename a member */
+	void AddMember(int64_t guild_id, int64_t member_id, const std::string &username, const std::string &discriminator);
+
+	/* Remove a member */
+	void RemoveMember(int64_t guild_id, int64_t member_id);
+
+	/* Add or rename a channel */
+	void AddChannel(int64_t guild_id, int64_t channel_id, const std::string &name);
+
+	/* Remove a channel */
+	void RemoveChannel(int64_t guild_id, int64_t channel_id);
+
+	/* True if the guild is in the index. If it isn't, callers should fall back to a scan */
+	bool HasGuild(int64_t guild_id);
+
+	/* Find members by full name (username#discriminator), any case */
+	bool FindFullName(int64_t guild_id, const std::string &full_name, std::vector<int64_t> &ids);
+
+	/* Find members by username, any case */
+	bool FindUsername(int64_t guild_id, const std::string &username, std::vector<int64_t> &ids);
+
+	/* Find channels by name, any case */
+	bool FindChannel(int64_t guild_id, const std::string &name, std::vector<int64_t> &ids);
+
+	/* Number of guilds, members and channels in the index, for diagnostics */
+	void Counts(size_t &guild_count, size_t &member_count, size_t &channel_count);
+};
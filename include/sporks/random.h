@@ -0,0 +1,36 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <cstdint>
+
+/**
+ * Per-thread pseudo random number generation.
+ *
+ * Each thread has its own xoshiro256** state, seeded on first use, so unlike rand()
+ * there is no shared state and no lock to fight over when events are being handled
+ * on many shards at once. Not suitable for anything cryptographic.
+ */
+namespace rng {
+	/* Next 64 bit value from the calling thread's generator */
+	uint64_t next();
+	/* Random integer in the inclusive range min to max */
+	int range(int min, int max);
+};
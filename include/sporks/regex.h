@@ -43,10 +43,13 @@ class PCRE
 	const char* pcre_error;
 	int pcre_error_ofs;
 	struct real_pcre* compiled_regex;
+	struct pcre_extra* extra;
  public:
 	/* Constructor */
 	PCRE(const std::string &match, bool case_insensitive = false);
 	~PCRE();
+	/* Bound the work a single match may do. A match which hits the limit fails. */
+	void SetMatchLimit(unsigned long limit);
 	/* Match methods */
 	bool Match(const std::string &comparison);
 	bool Match(const std::string &comparison, std::vector<std::string>& matches);
@@ -0,0 +1,60 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <unordered_map>
+#include <mutex>
+#include <ctime>
+#include <cstdint>
+
+/* How long a vote lasts, in seconds */
+const time_t vote_duration = 86400;
+
+/* The index is considered stale if it hasn't been refreshed for this many seconds */
+const time_t voter_index_max_age = 90;
+
+/**
+ * In-memory index of users with a current vote for the bot, mapping each snowflake id to the
+ * time its vote expires. The voting module refreshes it from infobot_votes every time it
+ * processes the table, so other modules can check a user's vote without a query.
+ *
+ * If the index hasn't been refreshed recently (e.g. just after startup, or the voting module
+ * isn't loaded), Fresh() returns false and callers should ask the database instead.
+ */
+class VoterIndex {
+	std::unordered_map<int64_t, time_t> expiries;
+	time_t refreshed;
+	std::mutex voters_mutex;
+
+public:
+	VoterIndex();
+
+	/* Replace the whole index with a new snowflake to expiry time map */
+	void Replace(std::unordered_map<int64_t, time_t> &voters);
+
+	/* True if the index was refreshed recently enough to be trusted */
+	bool Fresh();
+
+	/* True if the user has a vote which hasn't yet expired */
+	bool HasVoted(int64_t snowflake_id);
+
+	/* Number of users in the index */
+	size_t Size();
+};
@@ -29,6 +29,7 @@
 #include <unordered_map>
 #include <cstdint>
 #include <mutex>
+#include <algorithm>
 #include <stdlib.h>
 #include <sporks/statusfield.h>
 #include <sporks/regex.h>
@@ -55,7 +56,7 @@ public:
 	virtual std::string GetVersion()
 	{
 		/* NOTE: This version string below is modified by a pre-commit hook on the git repository */
-		std::string version = "$ModVer 16$";
+		std::string version = "$ModVer 17$";
 		return "1.0." + version.substr(8,version.length() - 9);
 	}
 
@@ -132,8 +133,27 @@ public:
 			}
 		}
 	
+		/* Users can also be given by name, as username or username#discriminator. Mentions have
+		 * already been replaced by usernames, so they resolve to users we already have and are
+		 * skipped. Names which match more than one member of the guild are ambiguous and ignored.
+		 */
+		std::string name;
+		while (param >> name) {
+			std::vector<int64_t> ids;
+			if (name.find('#') != std::string::npos) {
+				bot->names.FindFullName(message.get_guild_id().get(), name, ids);
+			} else {
+				bot->names.FindUsername(message.get_guild_id().get(), name, ids);
+			}
+			if (ids.size() == 1 && ids[0] != bot->getID() && std::find(mentions.begin(), mentions.end(), (uint64_t)ids[0]) == mentions.end()) {
+				mentions.push_back(ids[0]);
+				aegis::user* u = bot->core.find_user(ids[0]);
+				userlist += " " + (u ? u->get_username() : name);
+			}
+		}
+	
 		if (mentions.size() == 0 && operation != "list") {
-			EmbedSimple("You need to refer to the users to add or remove using mentions.", channelID);
+			EmbedSimple("You need to refer to the users to add or remove using mentions or their usernames.", channelID);
 			return;
 		}
 	
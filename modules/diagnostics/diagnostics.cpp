@@ -85,7 +85,7 @@ public:
 	virtual std::string GetVersion()
 	{
 		/* NOTE: This version string below is modified by a pre-commit hook on the git repository */
-		std::string version = "$ModVer 24$";
+		std::string version = "$ModVer 31$";
 		return "1.0." + version.substr(8,version.length() - 9);
 	}
 
@@ -213,10 +213,11 @@ public:
 						std::string sql;
 						std::getline(tokens, sql);
 						sql = trim(sql);
-						db::resultset rs = db::query(sql, {});
+						db::resultset rs;
+						bool ok = db::query(sql, {}, rs);
 						std::stringstream w;
 						if (rs.size() == 0) {
-							if (db::error() != "") {
+							if (!ok) {
 								EmbedSimple("SQL Error: " + db::error(), msg.get_channel_id().get());
 							} else {
 								EmbedSimple("Successfully executed, no rows returned.", msg.get_channel_id().get());
@@ -335,6 +336,19 @@ public:
 						}
 
 						w << fmt::format("  Total transfer: {} (U: {} | {:.2f}%) Memory usage: {}\n", aegis::utility::format_bytes(count), aegis::utility::format_bytes(u_count), (count / (double)u_count)*100, aegis::utility::format_bytes(aegis::utility::getCurrentRSS()));
+						size_t indexed_guilds = 0, indexed_members = 0, indexed_channels = 0;
+						bot->names.Counts(indexed_guilds, indexed_members, indexed_channels);
+						w << fmt::format("  Name index: {} guilds, {} members, {} channels\n", indexed_guilds, indexed_members, indexed_channels);
+						if (bot->counters.Has("nickpool_bytes")) {
+							w << fmt::format("  Nickname pool: {} names for {} members, {}\n", bot->counters.Get("nickpool_strings"), bot->counters.Get("nickpool_members"), aegis::utility::format_bytes(bot->counters.Get("nickpool_bytes")));
+						}
+						if (bot->counters.Has("js_heaps_created")) {
+							w << fmt::format("  JS heaps: {} created, {} reused\n", bot->counters.Get("js_heaps_created"), bot->counters.Get("js_heaps_reused"));
+						}
+						if (bot->counters.Has("userqueue")) {
+							w << fmt::format("  SQL cache queues: {} users ({} merged), {} guilds ({} dropped), writing {} users/sec\n", bot->counters.Get("userqueue"), bot->counters.Get("userqueue_merged"),
+								bot->counters.Get("guildqueue"), bot->counters.Get("guildqueue_dropped"), bot->counters.Get("userqueue_rate"));
+						}
 						w << fmt::format("- ╭──────┬──────────┬───────┬───────┬────────────────┬────────────┬───────────┬──────────╮\n");
 						w << fmt::format("- │shard#│  sequence│servers│members│uptime          │last message│transferred│reconnects│\n");
 						w << fmt::format("- ├──────┼──────────┼───────┼───────┼────────────────┼────────────┼───────────┼──────────┤\n");
@@ -377,6 +391,49 @@ public:
 								bot->sent_messages++;
 							}
 						}
+					} else if (lowercase(subcommand) == "jsprofile") {
+						/* Switch the JS profiler on or off for a channel, or show its profile */
+						int64_t channel_id = 0;
+						std::string operation;
+						tokens >> channel_id >> operation;
+						operation = lowercase(operation);
+						if (operation == "on" || operation == "off") {
+							db::query("UPDATE infobot_discord_javascript SET profile = ?, dirty = 1 WHERE id = ?", {(operation == "on"), channel_id});
+							EmbedSimple(fmt::format("JS profiling for <#{}> switched **{}**", channel_id, operation), msg.get_channel_id().get());
+						} else if (operation == "show") {
+							db::resultset rs = db::query("SELECT profile, profile_summary FROM infobot_discord_javascript WHERE id = ?", {channel_id});
+							if (rs.empty() || rs[0]["profile_summary"].empty()) {
+								EmbedSimple(fmt::format("No JS profile for <#{}>", channel_id), msg.get_channel_id().get());
+							} else {
+								json p = json::parse(rs[0]["profile_summary"], nullptr, false);
+								std::stringstream w;
+								w << "```diff\n";
+								w << fmt::format("{} JS profile for {}: {} runs, {:.2f}ms, {} samples\n", (rs[0]["profile"] == "1" ? "+" : "-"), channel_id, p.value("runs", 0), p.value("exec_ms", 0.0), p.value("samples", 0));
+								w << fmt::format("  Allocations: {} totalling {}, peak memory {}\n", p.value("allocations", 0), aegis::utility::format_bytes(p.value("allocated_bytes", 0)), aegis::utility::format_bytes(p.value("memory_peak", 0)));
+								w << "- Functions (self/total samples)\n";
+								for (auto & f : p.value("functions", json::array())) {
+									if (w.str().length() < 1300) {
+										w << fmt::format("  {:6} {:6} {}\n", f.value("self", 0), f.value("total", 0), f.value("name", ""));
+									}
+								}
+								w << "- Bindings (calls/ms)\n";
+								for (auto & b : p.value("bindings", json::array())) {
+									if (w.str().length() < 1900) {
+										w << fmt::format("  {:6} {:8.2f} {}\n", b.value("calls", 0), b.value("ms", 0.0), b.value("name", ""));
+									}
+								}
+								w << "```";
+								aegis::channel* c = bot->core.find_channel(msg.get_channel_id().get());
+								if (c) {
+									if (!bot->IsTestMode() || from_string<uint64_t>(Bot::GetConfig("test_server"), std::dec) == c->get_guild().get_id()) {
+										c->create_message(w.str());
+										bot->sent_messages++;
+									}
+								}
+							}
+						} else {
+							EmbedSimple("Usage: ``sudo jsprofile <channel id> on|off|show``", msg.get_channel_id().get());
+						}
 					} else {
 						/* Invalid command */
 						EmbedSimple("Sudo **what**? I don't know what that command means.", msg.get_channel_id().get());
@@ -0,0 +1,171 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <sporks/regex.h>
+#include <sporks/stringops.h>
+#include "aliascache.h"
+
+/* Compiled once; pcre_exec() is safe to call from many threads on the same compiled pattern */
+static PCRE alias_regex("<alias>\\s*(.*)", true);
+
+/* Cache keys are folded the same way the database collation folds key_word */
+static std::string alias_key(const std::string &key)
+{
+	return lowercase(trim(key));
+}
+
+AliasCache::AliasCache() : generation(0)
+{
+}
+
+bool AliasCache::IsAlias(const std::string &value, std::string &target)
+{
+	std::vector<std::string> matches;
+	if (alias_regex.Match(value, matches)) {
+		target = matches[1];
+		return true;
+	}
+	return false;
+}
+
+/**
+ * Walk from an alias to the first fact which isn't one, recording every key passed
+ * through in chain. A chain which revisits a key, or runs past alias_max_hops, is a cycle.
+ */
+AliasCache::resolved AliasCache::Follow(const infodef &fact, std::vector<std::string> &chain)
+{
+	resolved r;
+	r.alias_value = fact.value;
+	r.cycle = false;
+	r.when = time(NULL);
+
+	std::unordered_set<std::string> visited;
+	std::string next;
+	infodef current = fact;
+
+	chain.push_back(alias_key(fact.key));
+	visited.insert(chain.back());
+
+	while (IsAlias(current.value, next)) {
+		std::string k = alias_key(next);
+		if (chain.size() > alias_max_hops || visited.find(k) != visited.end()) {
+			r.cycle = true;
+			r.target.key = next;
+			return r;
+		}
+		chain.push_back(k);
+		visited.insert(k);
+		current = get_def(next);
+		if (!current.found) {
+			/* Broken alias, the target doesn't exist (yet) */
+			r.target.key = next;
+			return r;
+		}
+	}
+
+	r.target = current;
+	return r;
+}
+
+bool AliasCache::Resolve(const infodef &fact, infodef &target)
+{
+	std::string next;
+	if (!IsAlias(fact.value, next)) {
+		return false;
+	}
+
+	std::string key = alias_key(fact.key);
+	uint64_t started_generation;
+	{
+		std::lock_guard<std::mutex> alias_lock(alias_mutex);
+		auto e = entries.find(key);
+		if (e != entries.end() && e->second.alias_value == fact.value && time(NULL) - e->second.when < alias_cache_ttl) {
+			target = e->second.target;
+			return true;
+		}
+		started_generation = generation;
+	}
+
+	/* Not cached, or stale. The database is queried without holding the lock. */
+	std::vector<std::string> chain;
+	resolved r = Follow(fact, chain);
+	target = r.target;
+
+	std::lock_guard<std::mutex> alias_lock(alias_mutex);
+	if (generation != started_generation) {
+		/* Something changed while we were following the chain, so don't keep what we found */
+		return true;
+	}
+	if (entries.size() >= alias_cache_max || dependents.size() >= alias_cache_max * 4) {
+		entries.clear();
+		dependents.clear();
+	}
+	entries[key] = r;
+	for (auto c = chain.begin(); c != chain.end(); ++c) {
+		dependents[*c].insert(key);
+	}
+	return true;
+}
+
+void AliasCache::InvalidateLocked(const std::string &key)
+{
+	entries.erase(key);
+	auto d = dependents.find(key);
+	if (d != dependents.end()) {
+		for (auto a = d->second.begin(); a != d->second.end(); ++a) {
+			entries.erase(*a);
+		}
+		dependents.erase(d);
+	}
+	generation++;
+}
+
+void AliasCache::Changed(const std::string &key, const std::string &value, const std::string &word, const std::string &setby, time_t when, bool locked)
+{
+	{
+		std::lock_guard<std::mutex> alias_lock(alias_mutex);
+		InvalidateLocked(alias_key(key));
+	}
+
+	std::string next;
+	if (IsAlias(value, next)) {
+		infodef fact, target;
+		fact.found = true;
+		fact.key = lowercase(key);
+		fact.value = value;
+		fact.word = word;
+		fact.setby = setby;
+		fact.whenset = when;
+		fact.locked = locked;
+		Resolve(fact, target);
+	}
+}
+
+void AliasCache::Forgotten(const std::string &key)
+{
+	std::lock_guard<std::mutex> alias_lock(alias_mutex);
+	InvalidateLocked(alias_key(key));
+}
+
+size_t AliasCache::Size()
+{
+	std::lock_guard<std::mutex> alias_lock(alias_mutex);
+	return entries.size();
+}
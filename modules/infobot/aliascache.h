@@ -0,0 +1,100 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <ctime>
+#include "backend.h"
+
+/* Longest chain of aliases followed before giving up on it */
+const uint32_t alias_max_hops = 16;
+
+/* Seconds a resolved alias is trusted for, in case its target was changed outside the bot */
+const time_t alias_cache_ttl = 600;
+
+/* Maximum number of resolved aliases kept; the cache is emptied if it grows beyond this */
+const size_t alias_cache_max = 100000;
+
+/**
+ * AliasCache remembers where each <alias> fact ultimately leads, so that answering a
+ * question which hits an alias is a single cache lookup instead of one database query
+ * and regex match per hop.
+ *
+ * Chains are followed to the end, not just one level, and a chain which loops back on
+ * itself or is longer than alias_max_hops is remembered as a cycle. Every key a chain
+ * passes through is recorded, so that when any of them is changed or forgotten all the
+ * aliases which go through it are dropped and resolved again on next use.
+ */
+class AliasCache {
+
+	/* The result of following an alias chain */
+	struct resolved {
+		/* The alias fact's own value when it was resolved. If this differs, the alias was edited */
+		std::string alias_value;
+		/* The final, non-alias fact. found is false if the chain was broken or a cycle */
+		infodef target;
+		/* True if the chain looped back on itself or was too long */
+		bool cycle;
+		time_t when;
+	};
+
+	/* Lowercased alias key to its resolved target */
+	std::unordered_map<std::string, resolved> entries;
+
+	/* Lowercased key to the aliases whose chains pass through it */
+	std::unordered_map<std::string, std::unordered_set<std::string>> dependents;
+
+	/* Bumped on every invalidation, so a chain followed while a fact changed isn't stored */
+	uint64_t generation;
+
+	std::mutex alias_mutex;
+
+	/* Follow a chain from an alias fact, without holding alias_mutex */
+	resolved Follow(const infodef &fact, std::vector<std::string> &chain);
+
+	/* Drop a key's resolved entry and those of its dependents, caller must hold alias_mutex */
+	void InvalidateLocked(const std::string &key);
+
+public:
+	AliasCache();
+
+	/* If a fact's value is an alias, set target to the key it points at and return true */
+	static bool IsAlias(const std::string &value, std::string &target);
+
+	/* If fact is an alias, set target to the fact at the end of its chain and return true.
+	 * target.found is false if the chain is broken or loops. Returns false if fact is not an alias.
+	 */
+	bool Resolve(const infodef &fact, infodef &target);
+
+	/* Called whenever a fact is written. Dependents are invalidated and, if the new
+	 * value is itself an alias, it is resolved straight away.
+	 */
+	void Changed(const std::string &key, const std::string &value, const std::string &word, const std::string &setby, time_t when, bool locked);
+
+	/* Called whenever a fact is forgotten */
+	void Forgotten(const std::string &key);
+
+	/* Number of cached aliases */
+	size_t Size();
+};
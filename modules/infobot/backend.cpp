@@ -26,6 +26,7 @@
 #include <sporks/regex.h>
 #include <sporks/database.h>
 #include <sporks/stringops.h>
+#include <sporks/random.h>
 #include "backend.h"
 #include "infobot.h"
 
@@ -171,6 +172,7 @@ void InfobotModule::infobot_init()
 {
 	stats.startup = time(NULL);
 	stats.modcount = stats.qcount = 0;
+	facts.LoadAsync();
 }
 
 /* Remove trailing punctuation from a string, e.g. ?, !, . etc */
@@ -248,6 +250,8 @@ std::string InfobotModule::infobot_response(std::string mynick, std::string otex
 				} else {
 					/* Fact is not locked, delete it and confirm */
 					del_def(key);
+					facts.Remove(key);
+					aliases.Forgotten(key);
 					rpllist = "forgot";
 				}
 			} else {
@@ -315,6 +319,8 @@ std::string InfobotModule::infobot_response(std::string mynick, std::string otex
 				rpllist = "locked";
 			} else if (level == ADDRESSED_BY_NICKNAME_CORRECTION || reply.found == false) {
 				set_def(key, value, word, usernick, time(NULL), false);
+				facts.Add(lowercase(key));
+				aliases.Changed(key, value, word, usernick, time(NULL), false);
 				stats.modcount++;
 				if (level >= ADDRESSED_BY_NICKNAME) {
 					rpllist = "confirm";
@@ -328,6 +334,7 @@ std::string InfobotModule::infobot_response(std::string mynick, std::string otex
 						reply.value = reply.value + " or " + newvalue;
 					}
 					set_def(key, reply.value, reply.word, usernick, time(NULL), false);
+					aliases.Changed(key, reply.value, reply.word, usernick, time(NULL), false);
 					if (level >= ADDRESSED_BY_NICKNAME) {
 						rpllist = "confirm";
 					}
@@ -344,6 +351,12 @@ std::string InfobotModule::infobot_response(std::string mynick, std::string otex
 			stats.qcount++;
 			reply = get_def(key);
 
+			/* On an exact miss for something we'd answer, see if they meant a key we do know */
+			std::string nearest;
+			if (!reply.found && (direct_question || level >= ADDRESSED_BY_NICKNAME) && facts.Find(key, nearest)) {
+				reply = get_def(nearest);
+			}
+
 			if (reply.found) {
 				if (direct_question || level >= ADDRESSED_BY_NICKNAME /* did contain: || rand(15) > 13 */) {
 					rpllist = "replies";
@@ -384,20 +397,16 @@ std::string InfobotModule::infobot_response(std::string mynick, std::string otex
 				return "";
 			}
 
-			if (rpllist == "replies" && PCRE("<alias>\\s*(.*)", true).Match(reply.value, matches)) {
-				std::string oldkey = reply.key;
-				reply.key = matches[1];
-				infodef r = get_def(reply.key);
-				if (!r.found) {
-					/* Broken alias */
+			/* The cache follows the whole chain, so the target is never itself an alias and this repeats at most once */
+			infodef target;
+			if (rpllist == "replies" && aliases.Resolve(reply, target)) {
+				if (!target.found) {
+					/* Broken alias, or an alias loop */
 					def.found = false;
 					return "";
 				}
-				reply = r;
-				/* Prevent alias loops */
-				if (!PCRE("<alias>\\s*(.*)", true).Match(reply.value)) {
-					repeat = true;
-				}
+				reply = target;
+				repeat = true;
 			}
 		} while (repeat);
 
@@ -521,7 +530,7 @@ std::string getreply(std::vector<std::string> v)
 {
 	auto randIt = v.begin();
 	if (v.begin() != v.end()) {
-		std::advance(randIt, std::rand() % v.size());
+		std::advance(randIt, rng::range(0, v.size() - 1));
 		return *randIt;
 	} else {
 		return "";
@@ -540,7 +549,7 @@ std::string getreply(std::string s, const std::string &delim)
 	}
 	auto randIt = v.begin();
 	if (v.begin() != v.end()) {
-		std::advance(randIt, std::rand() % v.size());
+		std::advance(randIt, rng::range(0, v.size() - 1));
 		return *randIt;
 	} else {
 		return s;
@@ -21,6 +21,7 @@
 #pragma once
 #include <string>
 #include <vector>
+#include <atomic>
 
 enum reply_level {
 	NOT_ADDRESSED = 0,
@@ -28,10 +29,11 @@ enum reply_level {
 	ADDRESSED_BY_NICKNAME_CORRECTION = 2
 };
 
+/* Counters are atomic as messages are processed on many threads at once */
 struct infostats {
 	time_t startup;
-	uint64_t modcount;
-	uint64_t qcount;
+	std::atomic<uint64_t> modcount;
+	std::atomic<uint64_t> qcount;
 };
 
 struct infodef {
@@ -47,3 +49,6 @@ struct infodef {
 	~infodef();
 };
 
+/* Fetch a fact from the database, found is false if there is no such key */
+infodef get_def(const std::string &key);
+
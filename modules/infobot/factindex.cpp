@@ -0,0 +1,315 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <chrono>
+#include <algorithm>
+#include <cctype>
+#include <sporks/database.h>
+#include <sporks/stringops.h>
+#include "factindex.h"
+
+FactIndex::FactIndex() : thr_loader(nullptr), terminate(false)
+{
+}
+
+FactIndex::~FactIndex()
+{
+	terminate = true;
+	if (thr_loader) {
+		thr_loader->join();
+		delete thr_loader;
+	}
+}
+
+/**
+ * Strip the most common english plural endings from a single word, so that
+ * "what are containers" finds "container". This only has to be consistent
+ * with itself, not linguistically correct, as both sides of every comparison
+ * are stemmed the same way.
+ */
+static std::string stem_word(const std::string &w)
+{
+	size_t l = w.length();
+	if (l > 4 && w.compare(l - 3, 3, "ies") == 0) {
+		return w.substr(0, l - 3) + "y";
+	}
+	if (l > 4 && w.compare(l - 2, 2, "es") == 0 && (w[l - 3] == 's' || w[l - 3] == 'x' || w[l - 3] == 'z' || (l > 5 && (w.compare(l - 4, 2, "ch") == 0 || w.compare(l - 4, 2, "sh") == 0)))) {
+		return w.substr(0, l - 2);
+	}
+	if (l > 3 && w[l - 1] == 's' && w[l - 2] != 's' && w[l - 2] != 'u' && w[l - 2] != 'i') {
+		return w.substr(0, l - 1);
+	}
+	return w;
+}
+
+/**
+ * Normalise a key for comparison. Case is folded, apostrophes are removed so that
+ * "what's" and "whats" match, sentence punctuation becomes whitespace, runs of
+ * whitespace are collapsed and leading/trailing whitespace removed. Symbols which
+ * carry meaning in a key, such as the plusses in "c++", are left alone.
+ */
+std::string FactIndex::Normalise(const std::string &key, bool stem)
+{
+	std::string out;
+	std::string word;
+	out.reserve(key.length());
+	for (size_t i = 0; i <= key.length(); ++i) {
+		unsigned char c = (i < key.length() ? key[i] : ' ');
+		switch (c) {
+			case '\'':
+			case '`':
+				/* Dropped entirely */
+			break;
+			case ' ': case '\t': case '\r': case '\n': case '\f': case '\v':
+			case '?': case '!': case '.': case ',': case ';': case ':':
+			case '"': case '(': case ')': case '[': case ']': case '{': case '}':
+			case '-': case '_':
+				/* Word boundary */
+				if (!word.empty()) {
+					if (!out.empty()) {
+						out += ' ';
+					}
+					out += (stem ? stem_word(word) : word);
+					word.clear();
+				}
+			break;
+			default:
+				word += (c < 128 ? tolower(c) : c);
+			break;
+		}
+	}
+	return out;
+}
+
+/**
+ * Classic two-row Levenshtein distance. The row buffer is per-thread so that
+ * repeated calls while walking the tree don't allocate.
+ */
+uint32_t FactIndex::Distance(std::string_view a, std::string_view b)
+{
+	static thread_local std::vector<uint32_t> row;
+	if (a.length() < b.length()) {
+		std::swap(a, b);
+	}
+	row.resize(b.length() + 1);
+	for (size_t j = 0; j <= b.length(); ++j) {
+		row[j] = j;
+	}
+	for (size_t i = 1; i <= a.length(); ++i) {
+		uint32_t diagonal = row[0];
+		row[0] = i;
+		for (size_t j = 1; j <= b.length(); ++j) {
+			uint32_t above = row[j];
+			row[j] = std::min({ row[j] + 1, row[j - 1] + 1, diagonal + (a[i - 1] == b[j - 1] ? 0 : 1) });
+			diagonal = above;
+		}
+	}
+	return row[b.length()];
+}
+
+/**
+ * Start the background thread which fills the index from the database. The index is usable
+ * (but incomplete) while this runs, so questions are never blocked waiting for it.
+ */
+void FactIndex::LoadAsync()
+{
+	if (!thr_loader) {
+		thr_loader = new std::thread(&FactIndex::LoadThread, this);
+	}
+}
+
+/**
+ * Page through the infobot table in primary key order. Each page is a cheap range scan on the
+ * primary key, and the db mutex is released between pages so the bot keeps answering. Keys are
+ * normalised before taking the index lock, and inserted a few at a time so that the lock is
+ * never held for long enough to run a concurrent Find out of its budget.
+ */
+void FactIndex::LoadThread()
+{
+	std::string last;
+	std::vector<std::string> normalised;
+	while (!terminate) {
+		db::resultset r = db::query("SELECT key_word FROM infobot WHERE key_word > '?' ORDER BY key_word LIMIT ?", {last, fuzzy_load_batch});
+		if (r.empty()) {
+			break;
+		}
+		normalised.clear();
+		for (auto i = r.begin(); i != r.end(); ++i) {
+			normalised.push_back(Normalise((*i)["key_word"]));
+		}
+		for (size_t first = 0; first < r.size() && !terminate; first += fuzzy_insert_batch) {
+			std::lock_guard<std::timed_mutex> index_lock(index_mutex);
+			for (size_t i = first; i < std::min<size_t>(first + fuzzy_insert_batch, r.size()); ++i) {
+				AddLocked(r[i]["key_word"], normalised[i]);
+			}
+		}
+		last = r.back()["key_word"];
+		if (r.size() < fuzzy_load_batch) {
+			break;
+		}
+	}
+}
+
+void FactIndex::Add(const std::string &key)
+{
+	std::string n = Normalise(key);
+	std::lock_guard<std::timed_mutex> index_lock(index_mutex);
+	AddLocked(key, n);
+}
+
+/* Add a key to a node's list, moving it to the end (most recent) if it is already there */
+static void add_node_key(std::vector<std::string> &keys, const std::string &key)
+{
+	std::string lower = lowercase(key);
+	keys.erase(std::remove_if(keys.begin(), keys.end(), [&lower](const std::string &k) {
+		return lowercase(k) == lower;
+	}), keys.end());
+	keys.push_back(key);
+}
+
+void FactIndex::AddLocked(const std::string &key, const std::string &n)
+{
+	if (n.empty()) {
+		return;
+	}
+
+	auto existing = by_normalised.find(n);
+	if (existing != by_normalised.end()) {
+		add_node_key(nodes[existing->second].keys, key);
+		return;
+	}
+
+	if (nodes.empty()) {
+		nodes.push_back({ n, { key }, {} });
+		by_normalised[nodes.back().normalised] = 0;
+		return;
+	}
+
+	uint32_t current = 0;
+	while (true) {
+		uint32_t d = Distance(n, nodes[current].normalised);
+		if (d == 0) {
+			/* A previously removed key has been set again, revive its node */
+			add_node_key(nodes[current].keys, key);
+			by_normalised[nodes[current].normalised] = current;
+			return;
+		}
+		auto child = std::find_if(nodes[current].children.begin(), nodes[current].children.end(), [d](const std::pair<uint32_t, uint32_t> &c) {
+			return c.first == d;
+		});
+		if (child == nodes[current].children.end()) {
+			uint32_t index = nodes.size();
+			nodes.push_back({ n, { key }, {} });
+			nodes[current].children.push_back(std::make_pair(d, index));
+			by_normalised[nodes.back().normalised] = index;
+			return;
+		}
+		current = child->second;
+	}
+}
+
+/**
+ * BK-trees can't cheaply remove a node, so once the last key sharing a node is removed it is
+ * left in the tree as a dead node which still routes searches but is never returned as a match.
+ */
+void FactIndex::Remove(const std::string &key)
+{
+	std::string n = Normalise(key);
+	std::string lower = lowercase(key);
+	std::lock_guard<std::timed_mutex> index_lock(index_mutex);
+	auto existing = by_normalised.find(n);
+	if (existing != by_normalised.end()) {
+		std::vector<std::string> &keys = nodes[existing->second].keys;
+		keys.erase(std::remove_if(keys.begin(), keys.end(), [&lower](const std::string &k) {
+			return lowercase(k) == lower;
+		}), keys.end());
+		if (keys.empty()) {
+			by_normalised.erase(existing);
+		}
+	}
+}
+
+/**
+ * Find the nearest key to one which missed an exact lookup. Short keys are only ever matched
+ * after normalisation, as a single edit to a three letter word is a different word entirely.
+ * If the time budget runs out mid-search, the best match found so far (if any) is used.
+ */
+bool FactIndex::Find(const std::string &key, std::string &nearest)
+{
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(fuzzy_budget_us);
+	std::string n = Normalise(key);
+	if (n.empty()) {
+		return false;
+	}
+
+	/* The loader only holds the lock briefly, but if it can't be had in time, give up */
+	std::unique_lock<std::timed_mutex> index_lock(index_mutex, deadline);
+	if (!index_lock.owns_lock()) {
+		return false;
+	}
+
+	auto exact = by_normalised.find(n);
+	if (exact != by_normalised.end()) {
+		nearest = nodes[exact->second].keys.back();
+		return true;
+	}
+
+	uint32_t max_distance = (n.length() < 5 ? 0 : (n.length() < 9 ? 1 : 2));
+	if (max_distance == 0 || nodes.empty()) {
+		return false;
+	}
+
+	uint32_t best_distance = max_distance + 1;
+	uint32_t best = 0;
+	uint32_t visited = 0;
+	std::vector<uint32_t> pending = { 0 };
+	while (!pending.empty()) {
+		if ((++visited & 63) == 0 && std::chrono::steady_clock::now() > deadline) {
+			break;
+		}
+		uint32_t current = pending.back();
+		pending.pop_back();
+		uint32_t d = Distance(n, nodes[current].normalised);
+		if (d < best_distance && !nodes[current].keys.empty()) {
+			best_distance = d;
+			best = current;
+		}
+		/* Only look for strictly better matches than the best so far */
+		uint32_t radius = best_distance - 1;
+		for (auto c = nodes[current].children.begin(); c != nodes[current].children.end(); ++c) {
+			if (c->first + radius >= d && c->first <= d + radius) {
+				pending.push_back(c->second);
+			}
+		}
+	}
+
+	if (best_distance <= max_distance) {
+		nearest = nodes[best].keys.back();
+		return true;
+	}
+	return false;
+}
+
+size_t FactIndex::Size()
+{
+	std::lock_guard<std::timed_mutex> index_lock(index_mutex);
+	return by_normalised.size();
+}
+
@@ -0,0 +1,109 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+/* Maximum time a single fuzzy lookup may spend walking the index, in microseconds */
+const uint64_t fuzzy_budget_us = 2000;
+
+/* Number of keys fetched from the database per query while building the index */
+const uint32_t fuzzy_load_batch = 5000;
+
+/* Number of fetched keys inserted per hold of the index lock while building the index */
+const uint32_t fuzzy_insert_batch = 100;
+
+/**
+ * FactIndex is a secondary, in-memory index over the key words of the infobot table.
+ * It is only consulted when an exact key lookup misses, and answers "what key did they
+ * probably mean?" by first comparing normalised forms of the keys (case folded, punctuation
+ * and whitespace collapsed, plurals stemmed) and then searching a BK-tree of the normalised
+ * keys for the nearest key within a small edit distance.
+ *
+ * Every lookup is bounded by fuzzy_budget_us so that a miss can never add more than a
+ * couple of milliseconds to the time taken to answer a message.
+ */
+class FactIndex {
+
+	/* A node of the BK-tree. Children are stored as (edit distance, node index) pairs.
+	 * Every key which normalises to the same form shares a node, so the node lists them all,
+	 * most recently added last, and is only dead once all of them are removed.
+	 */
+	struct node {
+		std::string normalised;
+		std::vector<std::string> keys;
+		std::vector<std::pair<uint32_t, uint32_t>> children;
+	};
+
+	/* Nodes live in a deque so that string_views into them stay valid as the tree grows */
+	std::deque<node> nodes;
+
+	/* Normalised key to node index, for the cheap exact-after-normalisation check */
+	std::unordered_map<std::string_view, uint32_t> by_normalised;
+
+	/* Protects nodes and by_normalised. Timed, so that Find can give up on it within its budget */
+	std::timed_mutex index_mutex;
+
+	/* Background loader thread, and the flag which tells it to stop */
+	std::thread* thr_loader;
+	std::atomic<bool> terminate;
+
+	/* Insert a key with its normalised form, caller must hold index_mutex */
+	void AddLocked(const std::string &key, const std::string &normalised);
+
+	/* Loader thread body, pages through the infobot table in key order */
+	void LoadThread();
+
+public:
+	FactIndex();
+	~FactIndex();
+
+	/* Start loading all existing keys from the database in a background thread */
+	void LoadAsync();
+
+	/* Add or revive a key, called whenever a fact is written */
+	void Add(const std::string &key);
+
+	/* Remove a key, called whenever a fact is forgotten */
+	void Remove(const std::string &key);
+
+	/* Find the closest existing key to a key which missed an exact lookup.
+	 * Returns true and sets nearest if a match was found within the time budget.
+	 */
+	bool Find(const std::string &key, std::string &nearest);
+
+	/* Number of live normalised forms in the index */
+	size_t Size();
+
+	/* Case fold, collapse punctuation and whitespace, and optionally stem plurals */
+	static std::string Normalise(const std::string &key, bool stem = true);
+
+	/* Levenshtein distance between two strings */
+	static uint32_t Distance(std::string_view a, std::string_view b);
+};
+
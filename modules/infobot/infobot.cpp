@@ -25,34 +25,36 @@
 #include <sporks/config.h>
 #include <sporks/stringops.h>
 #include <sporks/modules.h>
+#include <sporks/random.h>
 #include <iostream>
 #include <sstream>
 #include "backend.h"
 
 int InfobotModule::random(int min, int max)
 {
-	static bool first = true;
-	if (first) {
-		srand(time(NULL));
-		first = false;
-	}
-	return min + rand() % (( max + 1 ) - min);
+	return rng::range(min, max);
 }
 
 QueueStats InfobotModule::GetQueueStats() {
 	QueueStats q;
 	q.users = 0;
 	q.guilds = 0;
-	if (bot->counters.find("userqueue") != bot->counters.end()) {
-		q.users = bot->counters["userqueue"];
-	}
-	if (bot->counters.find("guildqueue") != bot->counters.end()) {
-		q.guilds = bot->counters["guildqueue"];
-	}
+	q.user_rate = 0;
+	q.users = bot->counters.Get("userqueue");
+	q.guilds = bot->counters.Get("guildqueue");
+	q.user_rate = bot->counters.Get("userqueue_rate");
 
 	return q;
 }
 
+void InfobotModule::UpdateNickCounters()
+{
+	NickPoolStats ns = nicks.GetStats();
+	bot->counters.Set("nickpool_strings", ns.strings);
+	bot->counters.Set("nickpool_members", ns.members);
+	bot->counters.Set("nickpool_bytes", ns.bytes);
+}
+
 void InfobotModule::Input(QueueItem &query)
 {
 	/* Process anything in the inputs queue */
@@ -67,11 +69,7 @@ void InfobotModule::Input(QueueItem &query)
 	has_item = query.mentioned || settings::IsLearningEnabled(channel_settings);
 
 	if (has_item) {
-		/* Fix: If there isnt a list yet, don't try and do this otherwise it will result in a call of random(0, -1) and a SIGFPE */
-		std::string randnick = "";
-		if (nickList.find(query.serverID) != nickList.end() && this->nickList[query.serverID].size() > 0) {
-			randnick =  this->nickList[query.serverID][random(0, this->nickList[query.serverID].size() - 1)];
-		}
+		std::string randnick = nicks.Random(query.serverID);
 
 		/* Mangle common prefixes, so if someone asks "What is x" it is treated same as "x?" */
 		std::string cleaned_message = query.message;
@@ -121,8 +119,9 @@ void InfobotModule::Input(QueueItem &query)
 
 InfobotModule::InfobotModule(Bot* instigator, ModuleLoader* ml) : Module(instigator, ml)
 {
-	ml->Attach({ I_OnMessage, I_OnGuildCreate }, this);
+	ml->Attach({ I_OnMessage, I_OnGuildCreate, I_OnGuildDelete, I_OnGuildMemberAdd, I_OnGuildMemberRemove }, this);
 	infobot_init();
+	UpdateNickCounters();
 }
 
 InfobotModule::~InfobotModule()
@@ -132,7 +131,7 @@ InfobotModule::~InfobotModule()
 std::string InfobotModule::GetVersion()
 {
 	/* NOTE: This version string below is modified by a pre-commit hook on the git repository */
-	std::string version = "$ModVer 15$";
+	std::string version = "$ModVer 18$";
 	return "1.0." + version.substr(8,version.length() - 9);
 }
 
@@ -143,10 +142,34 @@ std::string InfobotModule::GetDescription()
 
 bool InfobotModule::OnGuildCreate(const modevent::guild_create &gc)
 {
-	this->nickList[gc.guild.id.get()] = std::vector<std::string>();
+	std::vector<std::pair<int64_t, std::string>> members;
+	members.reserve(gc.guild.members.size());
 	for (auto i = gc.guild.members.begin(); i != gc.guild.members.end(); ++i) {
-		this->nickList[gc.guild.id.get()].push_back(i->_user.username);
+		members.push_back(std::make_pair(i->_user.id.get(), i->_user.username));
 	}
+	nicks.SetGuild(gc.guild.id.get(), members);
+	UpdateNickCounters();
+	return true;
+}
+
+bool InfobotModule::OnGuildDelete(const modevent::guild_delete &gd)
+{
+	nicks.RemoveGuild(gd.guild_id.get());
+	UpdateNickCounters();
+	return true;
+}
+
+bool InfobotModule::OnGuildMemberAdd(const modevent::guild_member_add &gma)
+{
+	nicks.Add(gma.member.guild_id.get(), gma.member._user.id.get(), gma.member._user.username);
+	UpdateNickCounters();
+	return true;
+}
+
+bool InfobotModule::OnGuildMemberRemove(const modevent::guild_member_remove &gmr)
+{
+	nicks.Remove(gmr.guild_id.get(), gmr.user.id.get());
+	UpdateNickCounters();
 	return true;
 }
 
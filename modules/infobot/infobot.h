@@ -27,20 +27,31 @@
 #include <sporks/modules.h>
 #include "queue.h"
 #include "backend.h"
+#include "factindex.h"
+#include "nickpool.h"
+#include "aliascache.h"
 
 using json = nlohmann::json; 
 
-typedef std::unordered_map<int64_t, std::vector<std::string>> RandomNickCache;
-
 /**
  * Infobot module: Allows smart responses from the botnix/infobot.pm system.
  */
 class InfobotModule : public Module
 {
 	/**
-	 *  Contains a vector of nicknames per-server for selecting a random nickname only
+	 *  Interned usernames per-server for selecting a random nickname only
+	 */
+	NickPool nicks;
+
+	/**
+	 * Secondary index of normalised fact keys, used to find near misses when an exact lookup fails
+	 */
+	FactIndex facts;
+
+	/**
+	 * Where each <alias> fact ends up, so answering through an alias doesn't walk the chain every time
 	 */
-	RandomNickCache nickList;
+	AliasCache aliases;
 
 	/**
 	 * Report bot status as an embed
@@ -52,6 +63,11 @@ class InfobotModule : public Module
 	 */
 	QueueStats GetQueueStats();
 
+	/**
+	 * Publish nickname pool memory usage to the bot counters for diagnostics
+	 */
+	void UpdateNickCounters();
+
 	void infobot_init();
 	std::string infobot_response(std::string mynick, std::string otext, std::string usernick, std::string randuser, int64_t channelID, infodef &def, bool mentioned);
 
@@ -66,6 +82,9 @@ public:
 
 	virtual bool OnMessage(const modevent::message_create &message, const std::string& clean_message, bool mentioned, const std::vector<std::string> &stringmentions);
 	virtual bool OnGuildCreate(const modevent::guild_create &gc);
+	virtual bool OnGuildDelete(const modevent::guild_delete &gd);
+	virtual bool OnGuildMemberAdd(const modevent::guild_member_add &gma);
+	virtual bool OnGuildMemberRemove(const modevent::guild_member_remove &gmr);
 
 	/**
 	 * Random integer in range
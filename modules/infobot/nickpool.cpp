@@ -0,0 +1,177 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <algorithm>
+#include <sporks/random.h>
+#include "nickpool.h"
+
+NickPool::NickPool() : string_bytes(0), guild_bytes(0), member_count(0)
+{
+}
+
+/**
+ * Return the id of an interned string, adding it to the pool if it isn't there yet.
+ * Every call must be balanced by a call to Release().
+ */
+uint32_t NickPool::Intern(const std::string &s)
+{
+	auto i = lookup.find(s);
+	if (i != lookup.end()) {
+		refcounts[i->second]++;
+		return i->second;
+	}
+	uint32_t id;
+	if (!free_ids.empty()) {
+		id = free_ids.back();
+		free_ids.pop_back();
+		strings[id] = s;
+		refcounts[id] = 1;
+	} else {
+		id = strings.size();
+		strings.push_back(s);
+		refcounts.push_back(1);
+	}
+	string_bytes += strings[id].length();
+	lookup[strings[id]] = id;
+	return id;
+}
+
+/**
+ * Drop a reference to an interned string, freeing its slot when nobody uses it
+ */
+void NickPool::Release(uint32_t id)
+{
+	if (--refcounts[id] == 0) {
+		lookup.erase(strings[id]);
+		string_bytes -= strings[id].length();
+		std::string().swap(strings[id]);
+		free_ids.push_back(id);
+	}
+}
+
+std::vector<NickPool::entry>& NickPool::Guild(int64_t guild_id)
+{
+	auto g = guilds.try_emplace(guild_id);
+	if (g.second) {
+		guild_bytes += sizeof(*g.first);
+	}
+	return g.first->second;
+}
+
+void NickPool::SetGuild(int64_t guild_id, const std::vector<std::pair<int64_t, std::string>> &members)
+{
+	std::lock_guard<std::mutex> pool_lock(pool_mutex);
+	std::vector<entry> &list = Guild(guild_id);
+	for (auto & e : list) {
+		Release(e.nick);
+	}
+	member_count -= list.size();
+	guild_bytes -= list.capacity() * sizeof(entry);
+	list.clear();
+	list.reserve(members.size());
+	for (auto & m : members) {
+		list.push_back({ m.first, Intern(m.second) });
+	}
+	list.shrink_to_fit();
+	member_count += list.size();
+	guild_bytes += list.capacity() * sizeof(entry);
+}
+
+void NickPool::RemoveGuild(int64_t guild_id)
+{
+	std::lock_guard<std::mutex> pool_lock(pool_mutex);
+	auto g = guilds.find(guild_id);
+	if (g != guilds.end()) {
+		for (auto & e : g->second) {
+			Release(e.nick);
+		}
+		member_count -= g->second.size();
+		guild_bytes -= g->second.capacity() * sizeof(entry) + sizeof(*g);
+		guilds.erase(g);
+	}
+}
+
+/**
+ * Joins are rare compared to messages, so a linear scan to catch duplicates and renames
+ * is cheaper overall than keeping a per-guild hash of member positions in memory.
+ */
+void NickPool::Add(int64_t guild_id, int64_t member_id, const std::string &username)
+{
+	std::lock_guard<std::mutex> pool_lock(pool_mutex);
+	std::vector<entry> &list = Guild(guild_id);
+	uint32_t nick = Intern(username);
+	auto existing = std::find_if(list.begin(), list.end(), [member_id](const entry &e) { return e.member_id == member_id; });
+	if (existing != list.end()) {
+		Release(existing->nick);
+		existing->nick = nick;
+	} else {
+		guild_bytes -= list.capacity() * sizeof(entry);
+		list.push_back({ member_id, nick });
+		guild_bytes += list.capacity() * sizeof(entry);
+		member_count++;
+	}
+}
+
+/**
+ * Remove a member by swapping the last entry into their slot, keeping the vector dense
+ */
+void NickPool::Remove(int64_t guild_id, int64_t member_id)
+{
+	std::lock_guard<std::mutex> pool_lock(pool_mutex);
+	auto g = guilds.find(guild_id);
+	if (g == guilds.end()) {
+		return;
+	}
+	std::vector<entry> &list = g->second;
+	auto existing = std::find_if(list.begin(), list.end(), [member_id](const entry &e) { return e.member_id == member_id; });
+	if (existing != list.end()) {
+		Release(existing->nick);
+		*existing = list.back();
+		list.pop_back();
+		member_count--;
+	}
+}
+
+std::string NickPool::Random(int64_t guild_id)
+{
+	std::lock_guard<std::mutex> pool_lock(pool_mutex);
+	auto g = guilds.find(guild_id);
+	if (g == guilds.end() || g->second.empty()) {
+		return "";
+	}
+	return strings[g->second[rng::range(0, g->second.size() - 1)].nick];
+}
+
+/**
+ * Approximate memory in use. Hash table overhead is estimated at two pointers per bucket
+ * plus a node per element, which is close enough for spotting trends in shardstats.
+ */
+NickPoolStats NickPool::GetStats()
+{
+	std::lock_guard<std::mutex> pool_lock(pool_mutex);
+	NickPoolStats s;
+	s.strings = lookup.size();
+	s.members = member_count;
+	s.bytes = string_bytes + strings.size() * (sizeof(std::string) + sizeof(uint32_t)) + free_ids.capacity() * sizeof(uint32_t);
+	s.bytes += lookup.bucket_count() * sizeof(void*) + lookup.size() * (sizeof(std::string_view) + sizeof(uint32_t) + 2 * sizeof(void*));
+	s.bytes += guild_bytes;
+	return s;
+}
+
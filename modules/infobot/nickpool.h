@@ -0,0 +1,102 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+
+/**
+ * Memory used by a NickPool, for reporting in diagnostics
+ */
+struct NickPoolStats {
+	uint64_t strings;
+	uint64_t members;
+	uint64_t bytes;
+};
+
+/**
+ * NickPool holds the usernames used for <random> in infobot replies.
+ *
+ * Each distinct username is stored once in a reference counted intern pool shared by
+ * all guilds, and each guild keeps a compact vector of (member id, string id) pairs.
+ * A user who shares fifty guilds with the bot costs one string and fifty small entries,
+ * instead of fifty string copies. Picking a random nickname is a single index into the
+ * guild's vector.
+ */
+class NickPool {
+
+	/* One member of a guild, referring to their username in the intern pool */
+	struct entry {
+		int64_t member_id;
+		uint32_t nick;
+	};
+
+	/* Interned strings. A deque, so string_views into them stay valid as it grows */
+	std::deque<std::string> strings;
+	std::vector<uint32_t> refcounts;
+	std::vector<uint32_t> free_ids;
+	std::unordered_map<std::string_view, uint32_t> lookup;
+
+	/* Per-guild member lists */
+	std::unordered_map<int64_t, std::vector<entry>> guilds;
+
+	/* Running totals of bytes held by interned strings and by the per-guild lists, kept up
+	 * to date as they change so that GetStats() never has to walk every guild.
+	 */
+	uint64_t string_bytes;
+	uint64_t guild_bytes;
+	uint64_t member_count;
+
+	std::mutex pool_mutex;
+
+	/* Intern and release strings, caller must hold pool_mutex */
+	uint32_t Intern(const std::string &s);
+	void Release(uint32_t id);
+
+	/* Find or create a guild's member list, caller must hold pool_mutex */
+	std::vector<entry>& Guild(int64_t guild_id);
+
+public:
+	NickPool();
+
+	/* Replace the member list of a guild, e.g. on guild create */
+	void SetGuild(int64_t guild_id, const std::vector<std::pair<int64_t, std::string>> &members);
+
+	/* Forget a guild entirely */
+	void RemoveGuild(int64_t guild_id);
+
+	/* Add or rename a single member */
+	void Add(int64_t guild_id, int64_t member_id, const std::string &username);
+
+	/* Remove a single member */
+	void Remove(int64_t guild_id, int64_t member_id);
+
+	/* Uniformly pick a username from a guild, or an empty string if we know of nobody */
+	std::string Random(int64_t guild_id);
+
+	/* Report counts and approximate memory usage, in constant time */
+	NickPoolStats GetStats();
+};
+
@@ -29,6 +29,8 @@ using json = nlohmann::json;
 struct QueueStats {
 	uint64_t users;
 	uint64_t guilds;
+	/* Users written to the cache per second, over the last few seconds */
+	uint64_t user_rate;
 };
 
 /**
@@ -53,7 +53,7 @@ void InfobotModule::ShowStatus(int days, int hours, int minutes, int seconds, ui
 		statusfield("Approx. Fact Count", Comma(facts)),
 		statusfield("Total Servers", Comma(servers)),
 		statusfield("Online Users", Comma(users)),
-		statusfield("Queue State", "U:"+Comma(qs.users)+", G:"+Comma(qs.guilds)),
+		statusfield("Queue State", "U:"+Comma(qs.users)+" ("+Comma(qs.user_rate)+"/s), G:"+Comma(qs.guilds)),
 		statusfield("Uptime", std::string(uptime)),
 		statusfield("Shards", Comma(bot->core.shard_max_count)),
 		statusfield("Test Mode", bot->IsTestMode() ? ":white_check_mark: Yes" : "<:wc_rs:667695516737470494> No"),
@@ -0,0 +1,156 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <cstdlib>
+#include <cstring>
+#include "arena.h"
+
+SandboxArena::SandboxArena() : chunks(nullptr), bump(nullptr), bump_end(nullptr), reserved(0)
+{
+	memset(free_lists, 0, sizeof(free_lists));
+}
+
+SandboxArena::~SandboxArena()
+{
+	while (chunks) {
+		chunk* next = chunks->next;
+		free(chunks);
+		chunks = next;
+	}
+}
+
+size_t SandboxArena::Round(size_t size)
+{
+	return (size + arena_granularity - 1) & ~(arena_granularity - 1);
+}
+
+void* SandboxArena::Carve(size_t capacity)
+{
+	size_t needed = sizeof(header) + capacity;
+	if (!bump || bump + needed > bump_end) {
+		/* Whatever is left of the current chunk is too small for this size; it is simply abandoned */
+		chunk* c = (chunk*)malloc(arena_chunk_size);
+		if (!c) {
+			return nullptr;
+		}
+		c->next = chunks;
+		chunks = c;
+		reserved += arena_chunk_size;
+		bump = (char*)(c + 1);
+		bump_end = (char*)c + arena_chunk_size;
+	}
+	void* block = (void*)(((header*)bump) + 1);
+	bump += needed;
+	return block;
+}
+
+void* SandboxArena::Alloc(size_t size)
+{
+	if (size == 0) {
+		return nullptr;
+	}
+	size_t capacity = Round(size);
+	header* h;
+	if (capacity > arena_small_max) {
+		h = (header*)malloc(sizeof(header) + size);
+		if (!h) {
+			return nullptr;
+		}
+		reserved += sizeof(header) + size;
+	} else {
+		free_block* &list = free_lists[capacity / arena_granularity];
+		if (list) {
+			h = ((header*)list) - 1;
+			list = list->next;
+		} else {
+			void* block = Carve(capacity);
+			if (!block) {
+				return nullptr;
+			}
+			h = ((header*)block) - 1;
+		}
+	}
+	h->size = size;
+	return (void*)(h + 1);
+}
+
+void SandboxArena::Free(void* ptr)
+{
+	if (!ptr) {
+		return;
+	}
+	header* h = ((header*)ptr) - 1;
+	size_t capacity = Round(h->size);
+	if (capacity > arena_small_max) {
+		reserved -= sizeof(header) + h->size;
+		free((void*)h);
+		return;
+	}
+	free_block* b = (free_block*)ptr;
+	b->next = free_lists[capacity / arena_granularity];
+	free_lists[capacity / arena_granularity] = b;
+}
+
+void* SandboxArena::Realloc(void* ptr, size_t size)
+{
+	if (!ptr) {
+		return Alloc(size);
+	}
+	if (size == 0) {
+		Free(ptr);
+		return nullptr;
+	}
+	header* h = ((header*)ptr) - 1;
+	size_t old_size = h->size;
+	size_t old_capacity = Round(old_size);
+	size_t capacity = Round(size);
+	if (capacity == old_capacity && capacity <= arena_small_max) {
+		/* Same size class, nothing to move */
+		h->size = size;
+		return ptr;
+	}
+	if (capacity > arena_small_max && old_capacity > arena_small_max) {
+		/* Both large, let malloc() grow or shrink it in place if it can */
+		header* t = (header*)realloc((void*)h, sizeof(header) + size);
+		if (!t) {
+			return nullptr;
+		}
+		reserved = reserved - old_size + size;
+		t->size = size;
+		return (void*)(t + 1);
+	}
+	void* moved = Alloc(size);
+	if (!moved) {
+		return nullptr;
+	}
+	memcpy(moved, ptr, old_size < size ? old_size : size);
+	Free(ptr);
+	return moved;
+}
+
+size_t SandboxArena::Size(void* ptr)
+{
+	return (((header*)ptr) - 1)->size;
+}
+
+size_t SandboxArena::Reserved()
+{
+	return reserved;
+}
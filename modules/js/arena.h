@@ -0,0 +1,91 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/* Allocations are rounded up to a multiple of this, which also keeps them aligned for doubles */
+const size_t arena_granularity = 8;
+
+/* Allocations up to this size are carved from the arena and recycled by size class. Larger ones go to malloc(). */
+const size_t arena_small_max = 1024;
+
+/* Size of each block of memory the arena takes from malloc() */
+const size_t arena_chunk_size = 64 * 1024;
+
+/**
+ * A bump allocator with per size class free lists, used to back one Duktape heap.
+ *
+ * Duktape makes a very large number of small allocations, most of which are freed again
+ * shortly afterwards. Here a small allocation is a pop from a free list, or failing that a
+ * pointer bump within the current chunk, and freeing one is a push onto its free list, so
+ * none of them reach malloc(). Memory is only handed back to malloc() when the arena is
+ * destroyed, which frees every chunk in one go regardless of how many objects were in them.
+ *
+ * Each allocation carries a small header recording its size class, as Duktape doesn't pass
+ * the size to free(). The arena is not thread safe; a heap is only ever used by one thread
+ * at a time.
+ */
+class SandboxArena {
+	/* Precedes every allocation, holding the size asked for. The double is there to keep the payload aligned. */
+	union header {
+		size_t size;
+		double align;
+	};
+
+	/* Overlaid on a free small allocation */
+	struct free_block {
+		free_block* next;
+	};
+
+	/* Chunks are kept in a singly linked list through their first bytes */
+	struct chunk {
+		chunk* next;
+		double align;
+	};
+
+	free_block* free_lists[arena_small_max / arena_granularity + 1];
+	chunk* chunks;
+	char* bump;
+	char* bump_end;
+	/* Bytes taken from malloc(), both chunks and large allocations */
+	size_t reserved;
+
+	/* Carve a small block of the given capacity from the current chunk, starting a new one if needed */
+	void* Carve(size_t capacity);
+
+	/* Size class capacity for a requested size */
+	static size_t Round(size_t size);
+
+public:
+	SandboxArena();
+	~SandboxArena();
+
+	void* Alloc(size_t size);
+	void* Realloc(void* ptr, size_t size);
+	void Free(void* ptr);
+
+	/* Size requested for an allocation made by this arena, for quota accounting */
+	static size_t Size(void* ptr);
+
+	/* Bytes currently held from malloc() */
+	size_t Reserved();
+};
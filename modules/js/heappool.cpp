@@ -0,0 +1,151 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <algorithm>
+#include "heappool.h"
+
+HeapPool::HeapPool(duk_alloc_function alloc, duk_realloc_function realloc, duk_free_function free, duk_fatal_function fatal) :
+	alloc_func(alloc), realloc_func(realloc), free_func(free), fatal_func(fatal), created(0), reused(0), destroyed(0)
+{
+}
+
+HeapPool::~HeapPool()
+{
+	std::lock_guard<std::mutex> pool_lock(pool_mutex);
+	for (auto h = idle.begin(); h != idle.end(); ++h) {
+		Destroy(*h);
+	}
+	idle.clear();
+}
+
+sandbox_heap* HeapPool::Acquire(size_t limit)
+{
+	time_t now = time(NULL);
+	{
+		std::lock_guard<std::mutex> pool_lock(pool_mutex);
+		ExpireLocked(now);
+		if (!idle.empty()) {
+			/* Most recently used first, it is the most likely to still be in cache */
+			sandbox_heap* heap = idle.back();
+			idle.pop_back();
+			heap->limit = limit;
+			heap->peak = heap->allocated;
+			heap->timer.interrupt = 0;
+			reused++;
+			return heap;
+		}
+	}
+
+	sandbox_heap* heap = new sandbox_heap();
+	heap->allocated = heap->peak = heap->baseline = heap->overhead = 0;
+	heap->limit = limit;
+	heap->runs = 0;
+	heap->last_used = now;
+	heap->poisoned = false;
+	heap->context = nullptr;
+	heap->profiler = nullptr;
+	heap->allocations = heap->allocated_bytes = 0;
+	heap->timer.timeout = 0;
+	heap->timer.interrupt = 0;
+	heap->timer.sample = NULL;
+	heap->timer.sample_interval = heap->timer.next_sample = 0;
+	gettimeofday(&heap->timer.start, NULL);
+	heap->ctx = duk_create_heap(alloc_func, realloc_func, free_func, (void*)heap, fatal_func);
+	if (!heap->ctx) {
+		delete heap;
+		return nullptr;
+	}
+	heap->baseline = heap->allocated;
+	created++;
+	return heap;
+}
+
+void HeapPool::Release(sandbox_heap* heap)
+{
+	if (heap->poisoned) {
+		/* After a fatal error Duktape makes no promise that the heap can even be destroyed
+		 * safely, so it is abandoned. Only the accounting struct is freed.
+		 */
+		delete heap;
+		destroyed++;
+		return;
+	}
+
+	/* Finalizers run by the GC below mustn't be profiled, the run's profiler is gone */
+	heap->profiler = nullptr;
+	heap->timer.sample = NULL;
+
+	/* Anything the run left behind is unreachable now its thread is gone. Two passes so
+	 * that objects with finalizers are really freed.
+	 */
+	duk_set_top(heap->ctx, 0);
+	duk_gc(heap->ctx, 0);
+	duk_gc(heap->ctx, 0);
+
+	heap->runs++;
+	heap->last_used = time(NULL);
+
+	std::lock_guard<std::mutex> pool_lock(pool_mutex);
+	if (heap->allocated > heap->baseline + heap_retain_growth || heap->arena.Reserved() > heap_retain_reserved || idle.size() >= heap_pool_max) {
+		Destroy(heap);
+		return;
+	}
+	idle.push_back(heap);
+}
+
+void HeapPool::Destroy(sandbox_heap* heap)
+{
+	duk_destroy_heap(heap->ctx);
+	delete heap;
+	destroyed++;
+}
+
+void HeapPool::ExpireLocked(time_t now)
+{
+	auto expired = std::remove_if(idle.begin(), idle.end(), [this, now](sandbox_heap* heap) {
+		if (now - heap->last_used > heap_idle_seconds) {
+			Destroy(heap);
+			return true;
+		}
+		return false;
+	});
+	idle.erase(expired, idle.end());
+}
+
+uint64_t HeapPool::Created()
+{
+	return created;
+}
+
+uint64_t HeapPool::Reused()
+{
+	return reused;
+}
+
+uint64_t HeapPool::Destroyed()
+{
+	return destroyed;
+}
+
+size_t HeapPool::Idle()
+{
+	std::lock_guard<std::mutex> pool_lock(pool_mutex);
+	return idle.size();
+}
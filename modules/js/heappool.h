@@ -0,0 +1,131 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <ctime>
+#include <type_traits>
+#include "duktape.h"
+#include "timeout.h"
+#include "arena.h"
+
+/* Idle heaps unused for longer than this many seconds are destroyed */
+const time_t heap_idle_seconds = 120;
+
+/* Maximum number of idle heaps kept warm */
+const size_t heap_pool_max = 8;
+
+/* A heap still holding this many bytes more than when it was new after a run and a full GC is destroyed rather than reused */
+const size_t heap_retain_growth = 64 * 1024;
+
+/* A heap whose arena has taken more than this from malloc() is destroyed rather than reused, so fragmentation can't build up */
+const size_t heap_retain_reserved = 1024 * 1024;
+
+/* Details of the script being run, defined by the JS module */
+struct sandbox_context;
+
+class ScriptProfiler;
+
+/**
+ * A Duktape heap, with the allocation accounting for it. The heap udata points at this,
+ * so the sandbox allocator can charge every allocation to the heap which made it, and
+ * bindings can find the script they are being called for.
+ */
+struct sandbox_heap {
+	/* Must be first, check_exec_timeout() is given the heap udata as a sandbox_timer* */
+	sandbox_timer timer;
+	duk_context* ctx;
+	/* The script currently running on this heap, or nullptr when idle */
+	sandbox_context* context;
+	/* Bytes currently allocated by this heap */
+	size_t allocated;
+	/* Highest value of allocated since the current run began */
+	size_t peak;
+	/* Number and total size of allocations since the current run began */
+	uint64_t allocations;
+	uint64_t allocated_bytes;
+	/* Profiler for the current run, or nullptr if it isn't being profiled */
+	ScriptProfiler* profiler;
+	/* Allocation quota for the current run */
+	size_t limit;
+	/* Bytes allocated by the heap when it was freshly created */
+	size_t baseline;
+	/* Bytes allocated at the start of the current run which a brand new heap wouldn't have had,
+	 * e.g. the run's fresh global environment. This is not charged to the script.
+	 */
+	size_t overhead;
+	/* Number of runs this heap has been used for */
+	uint64_t runs;
+	time_t last_used;
+	/* Set if the heap is in an unknown state, e.g. after a fatal error, and must never be reused */
+	bool poisoned;
+	/* Backs every allocation the heap makes, and is freed all at once with it */
+	SandboxArena arena;
+};
+
+static_assert(std::is_standard_layout<sandbox_heap>::value, "sandbox_heap must be standard layout so its address is also its timer's");
+
+/**
+ * HeapPool keeps a handful of idle Duktape heaps ready, so that running a script doesn't have
+ * to create and destroy a whole heap. Scripts never share state through a pooled heap, as every
+ * run gets a new thread with its own fresh global environment and built-ins (see
+ * duk_push_thread_new_globalenv()) which is thrown away when the run ends.
+ *
+ * A heap is destroyed instead of being returned to the pool if it is still holding much more
+ * memory than when it was created, if its arena has grown too large, or if it sits idle for
+ * too long. A poisoned heap is never
+ * returned to the pool.
+ */
+class HeapPool {
+	std::vector<sandbox_heap*> idle;
+	std::mutex pool_mutex;
+
+	duk_alloc_function alloc_func;
+	duk_realloc_function realloc_func;
+	duk_free_function free_func;
+	duk_fatal_function fatal_func;
+
+	std::atomic<uint64_t> created;
+	std::atomic<uint64_t> reused;
+	std::atomic<uint64_t> destroyed;
+
+	/* Destroy idle heaps which haven't been used recently, caller must hold pool_mutex */
+	void ExpireLocked(time_t now);
+
+public:
+	HeapPool(duk_alloc_function alloc, duk_realloc_function realloc, duk_free_function free, duk_fatal_function fatal);
+	~HeapPool();
+
+	/* Take a heap from the pool, or create a new one. Returns nullptr if a heap could not be created. */
+	sandbox_heap* Acquire(size_t limit);
+
+	/* Return a heap after a run, garbage collecting it. It may be destroyed instead of pooled. Poisoned heaps are abandoned. */
+	void Release(sandbox_heap* heap);
+
+	/* Destroy a heap immediately */
+	void Destroy(sandbox_heap* heap);
+
+	uint64_t Created();
+	uint64_t Reused();
+	uint64_t Destroyed();
+	size_t Idle();
+};
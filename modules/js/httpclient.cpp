@@ -0,0 +1,436 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <memory>
+#include <vector>
+#include <cstdlib>
+#include <algorithm>
+#include <cctype>
+#include <sporks/stringops.h>
+#include "httpclient.h"
+
+/* Bytes read from the socket at a time */
+const size_t http_read_size = 16 * 1024;
+
+/* Room allowed for the response headers on top of the body limit */
+const size_t http_max_headers = 64 * 1024;
+
+using asio::ip::tcp;
+
+static std::vector<std::string> http_split(const std::string &s, const std::string &delimiter)
+{
+	std::vector<std::string> parts;
+	size_t start = 0, end;
+	while ((end = s.find(delimiter, start)) != std::string::npos) {
+		parts.push_back(s.substr(start, end - start));
+		start = end + delimiter.length();
+	}
+	parts.push_back(s.substr(start));
+	return parts;
+}
+
+typedef asio::ssl::stream<tcp::socket> http_stream;
+
+/**
+ * One request, from resolving the host to calling the callback, including any redirects.
+ * Every handler runs on the client's io thread, so nothing here needs a lock. The object
+ * stays alive for as long as any of its handlers are pending.
+ */
+class http_fetch : public std::enable_shared_from_this<http_fetch> {
+	HTTPClient &client;
+	http_request request;
+	http_url url;
+	http_callback done;
+	int redirects;
+	bool finished;
+
+	tcp::resolver resolver;
+	std::unique_ptr<http_stream> stream;
+	/* Timer for the current stage (DNS or connection) */
+	asio::steady_timer stage_timer;
+	/* Timer for the request as a whole */
+	asio::steady_timer deadline;
+
+	std::string outgoing;
+	std::string incoming;
+	char buffer[http_read_size];
+
+public:
+	http_fetch(HTTPClient &c, const http_request &r, const http_url &u, const http_callback &d) :
+		client(c), request(r), url(u), done(d), redirects(0), finished(false),
+		resolver(c.io), stage_timer(c.io), deadline(c.io)
+	{
+		if (request.postdata.length() > http_max_post) {
+			request.postdata.resize(http_max_post);
+		}
+	}
+
+	void Start()
+	{
+		auto self = shared_from_this();
+		deadline.expires_after(http_total_timeout);
+		deadline.async_wait([self](const asio::error_code &ec) {
+			if (!ec) {
+				self->Fail("Request timed out");
+			}
+		});
+		Connect();
+	}
+
+private:
+	/* Start a stage timer, which abandons the request if the stage doesn't finish in time */
+	void StageTimeout(std::chrono::milliseconds timeout, const std::string &stage)
+	{
+		auto self = shared_from_this();
+		stage_timer.expires_after(timeout);
+		stage_timer.async_wait([self, stage](const asio::error_code &ec) {
+			if (!ec) {
+				self->Fail(stage + " timed out");
+			}
+		});
+	}
+
+	void Connect()
+	{
+		auto self = shared_from_this();
+		stream.reset(new http_stream(client.io, client.ssl));
+		incoming.clear();
+		StageTimeout(http_dns_timeout, "DNS lookup");
+		resolver.async_resolve(url.host, url.port, [self](const asio::error_code &ec, tcp::resolver::results_type results) {
+			if (self->finished) {
+				return;
+			}
+			if (ec) {
+				self->Fail("Can't resolve " + self->url.host + ": " + ec.message());
+				return;
+			}
+			self->StageTimeout(http_connect_timeout, "Connection");
+			asio::async_connect(self->stream->next_layer(), results, [self](const asio::error_code &ec, const tcp::endpoint &endpoint) {
+				if (self->finished) {
+					return;
+				}
+				if (ec) {
+					self->Fail("Can't connect to " + self->url.host + ": " + ec.message());
+					return;
+				}
+				if (self->url.https) {
+					self->Handshake();
+				} else {
+					self->stage_timer.cancel();
+					self->Send();
+				}
+			});
+		});
+	}
+
+	void Handshake()
+	{
+		auto self = shared_from_this();
+		/* SNI, and check the certificate is for the host we asked for */
+		SSL_set_tlsext_host_name(stream->native_handle(), url.host.c_str());
+		stream->set_verify_mode(asio::ssl::verify_peer);
+		stream->set_verify_callback(asio::ssl::rfc2818_verification(url.host));
+		stream->async_handshake(asio::ssl::stream_base::client, [self](const asio::error_code &ec) {
+			if (self->finished) {
+				return;
+			}
+			if (ec) {
+				self->Fail("TLS handshake with " + self->url.host + " failed: " + ec.message());
+				return;
+			}
+			self->stage_timer.cancel();
+			self->Send();
+		});
+	}
+
+	/* A POST body which looks like a JSON object is sent as JSON, anything else as a form */
+	std::string ContentType()
+	{
+		if (request.method == "POST") {
+			for (auto line : http_split(request.postdata, "\n")) {
+				line = trim(line);
+				if (line.length() > 2 && line[0] == '{' && line[line.length() - 1] == '}') {
+					return "application/json";
+				}
+			}
+		}
+		return "application/x-www-form-urlencoded";
+	}
+
+	void Send()
+	{
+		auto self = shared_from_this();
+		std::string host = url.host;
+		if ((url.https && url.port != "443") || (!url.https && url.port != "80")) {
+			host += ":" + url.port;
+		}
+		outgoing = request.method + " " + url.path + " HTTP/1.1\r\n"
+			"Host: " + host + "\r\n"
+			"User-Agent: " + http_user_agent + "\r\n"
+			"Content-Type: " + ContentType() + "\r\n"
+			"Accept-Encoding: identity\r\n"
+			"Connection: close\r\n";
+		if (request.method == "POST") {
+			outgoing += "Content-Length: " + std::to_string(request.postdata.length()) + "\r\n\r\n" + request.postdata;
+		} else {
+			outgoing += "\r\n";
+		}
+		auto written = [self](const asio::error_code &ec, size_t length) {
+			if (self->finished) {
+				return;
+			}
+			if (ec) {
+				self->Fail("Can't send request: " + ec.message());
+				return;
+			}
+			self->Read();
+		};
+		if (url.https) {
+			asio::async_write(*stream, asio::buffer(outgoing), written);
+		} else {
+			asio::async_write(stream->next_layer(), asio::buffer(outgoing), written);
+		}
+	}
+
+	void Read()
+	{
+		auto self = shared_from_this();
+		auto received = [self](const asio::error_code &ec, size_t length) {
+			if (self->finished) {
+				return;
+			}
+			self->incoming.append(self->buffer, length);
+			if (ec == asio::error::eof || ec == asio::ssl::error::stream_truncated || self->incoming.length() > http_max_response + http_max_headers) {
+				/* Connection closed, or we've had as much as we're going to take */
+				self->Received();
+			} else if (ec) {
+				self->Fail("Can't read response: " + ec.message());
+			} else {
+				self->Read();
+			}
+		};
+		if (url.https) {
+			stream->async_read_some(asio::buffer(buffer, sizeof(buffer)), received);
+		} else {
+			stream->next_layer().async_read_some(asio::buffer(buffer, sizeof(buffer)), received);
+		}
+	}
+
+	/* Decode a chunked body. Whatever arrived intact is kept if it was cut short. */
+	static std::string Dechunk(const std::string &chunked)
+	{
+		std::string body;
+		size_t pos = 0;
+		while (pos < chunked.length()) {
+			size_t eol = chunked.find("\r\n", pos);
+			if (eol == std::string::npos) {
+				break;
+			}
+			size_t size = strtoul(chunked.substr(pos, eol - pos).c_str(), nullptr, 16);
+			if (size == 0) {
+				break;
+			}
+			body.append(chunked, eol + 2, size);
+			pos = eol + 2 + size + 2;
+		}
+		return body;
+	}
+
+	void Received()
+	{
+		size_t head_end = incoming.find("\r\n\r\n");
+		if (head_end == std::string::npos || incoming.compare(0, 5, "HTTP/") != 0) {
+			Fail("Invalid response from " + url.host);
+			return;
+		}
+
+		std::vector<std::string> lines = http_split(incoming.substr(0, head_end), "\r\n");
+		std::vector<std::string> status_line = http_split(lines[0], " ");
+		uint32_t status = (status_line.size() > 1 ? from_string<uint32_t>(status_line[1], std::dec) : 0);
+		std::string location;
+		bool chunked = false;
+		for (size_t i = 1; i < lines.size(); ++i) {
+			size_t colon = lines[i].find(':');
+			if (colon == std::string::npos) {
+				continue;
+			}
+			std::string name = lowercase(trim(lines[i].substr(0, colon)));
+			std::string value = trim(lines[i].substr(colon + 1));
+			if (name == "location") {
+				location = value;
+			} else if (name == "transfer-encoding") {
+				chunked = (lowercase(value).find("chunked") != std::string::npos);
+			}
+		}
+
+		if ((status == 301 || status == 302 || status == 303 || status == 307 || status == 308) && !location.empty()) {
+			http_url next;
+			if (redirects >= http_max_redirects) {
+				Fail("Too many redirects");
+			} else if (!HTTPClient::Redirect(url, location, next)) {
+				Fail("Invalid redirect to " + location);
+			} else {
+				redirects++;
+				url = next;
+				asio::error_code ignored;
+				stream->next_layer().close(ignored);
+				Connect();
+			}
+			return;
+		}
+
+		std::string body = incoming.substr(head_end + 4);
+		if (chunked) {
+			body = Dechunk(body);
+		}
+		if (body.length() > http_max_response) {
+			body.resize(http_max_response);
+		}
+		Finish({ status, body, "" });
+	}
+
+	void Fail(const std::string &error)
+	{
+		Finish({ http_status_failed, "", error });
+	}
+
+	void Finish(const http_response &response)
+	{
+		if (finished) {
+			return;
+		}
+		finished = true;
+		/* Cancel everything outstanding, so that the remaining handlers run (and do nothing) promptly */
+		asio::error_code ignored;
+		stage_timer.cancel();
+		deadline.cancel();
+		resolver.cancel();
+		if (stream) {
+			stream->next_layer().close(ignored);
+		}
+		client.active--;
+		done(response);
+	}
+};
+
+HTTPClient::HTTPClient() : work(asio::make_work_guard(io)), ssl(asio::ssl::context::sslv23_client), active(0)
+{
+	ssl.set_default_verify_paths();
+	ssl.set_options(asio::ssl::context::default_workarounds | asio::ssl::context::no_sslv2 | asio::ssl::context::no_sslv3);
+	thr_io = new std::thread([this]() {
+		io.run();
+	});
+}
+
+HTTPClient::~HTTPClient()
+{
+	work.reset();
+	io.stop();
+	thr_io->join();
+	delete thr_io;
+}
+
+bool HTTPClient::Fetch(const http_request &request, const http_callback &done)
+{
+	http_url url;
+	if ((request.method != "GET" && request.method != "POST") || !ParseURL(request.url, url)) {
+		return false;
+	}
+	active++;
+	auto fetch = std::make_shared<http_fetch>(*this, request, url, done);
+	asio::post(io, [fetch]() {
+		fetch->Start();
+	});
+	return true;
+}
+
+uint64_t HTTPClient::Active()
+{
+	return active;
+}
+
+bool HTTPClient::ParseURL(const std::string &url, http_url &parsed)
+{
+	std::string lower = lowercase(url.substr(0, 8));
+	size_t authority;
+	if (lower.compare(0, 7, "http://") == 0) {
+		parsed.https = false;
+		parsed.port = "80";
+		authority = 7;
+	} else if (lower.compare(0, 8, "https://") == 0) {
+		parsed.https = true;
+		parsed.port = "443";
+		authority = 8;
+	} else {
+		/* Anything else, e.g. file://, is refused */
+		return false;
+	}
+
+	size_t path = url.find_first_of("/?#", authority);
+	std::string hostport = url.substr(authority, path == std::string::npos ? std::string::npos : path - authority);
+	if (hostport.empty() || hostport.find('@') != std::string::npos || hostport.find_first_of(" \t\r\n") != std::string::npos) {
+		return false;
+	}
+
+	size_t colon = hostport.rfind(':');
+	size_t bracket = hostport.rfind(']');
+	if (colon != std::string::npos && (bracket == std::string::npos || colon > bracket)) {
+		parsed.port = hostport.substr(colon + 1);
+		hostport = hostport.substr(0, colon);
+		if (parsed.port.empty() || parsed.port.find_first_not_of("0123456789") != std::string::npos) {
+			return false;
+		}
+	}
+	if (hostport.length() > 2 && hostport[0] == '[' && hostport[hostport.length() - 1] == ']') {
+		hostport = hostport.substr(1, hostport.length() - 2);
+	}
+	if (hostport.empty()) {
+		return false;
+	}
+	parsed.host = hostport;
+
+	parsed.path = (path == std::string::npos ? "/" : url.substr(path));
+	size_t fragment = parsed.path.find('#');
+	if (fragment != std::string::npos) {
+		parsed.path.erase(fragment);
+	}
+	if (parsed.path.empty() || parsed.path[0] != '/') {
+		parsed.path = "/" + parsed.path;
+	}
+	return parsed.path.find_first_of(" \r\n") == std::string::npos;
+}
+
+bool HTTPClient::Redirect(const http_url &from, const std::string &location, http_url &to)
+{
+	if (ParseURL(location, to)) {
+		return true;
+	}
+	std::string scheme = from.https ? "https:" : "http:";
+	std::string origin = scheme + "//" + (from.host.find(':') != std::string::npos ? "[" + from.host + "]" : from.host) + ":" + from.port;
+	if (location.compare(0, 2, "//") == 0) {
+		return ParseURL(scheme + location, to);
+	} else if (!location.empty() && location[0] == '/') {
+		return ParseURL(origin + location, to);
+	} else {
+		/* Relative to the directory of the current path */
+		std::string base = from.path.substr(0, from.path.find('?'));
+		return ParseURL(origin + base.substr(0, base.rfind('/') + 1) + location, to);
+	}
+}
@@ -0,0 +1,115 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <string>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <asio.hpp>
+#include <asio/ssl.hpp>
+
+/* Limits on each request, the same as those the old PHP web request worker enforced with curl */
+
+/* Time allowed for DNS resolution */
+const std::chrono::milliseconds http_dns_timeout(1000);
+
+/* Time allowed to establish the connection, including the TLS handshake */
+const std::chrono::milliseconds http_connect_timeout(2000);
+
+/* Time allowed for the entire request, including any redirects */
+const std::chrono::milliseconds http_total_timeout(5000);
+
+/* Maximum redirects followed per request */
+const int http_max_redirects = 3;
+
+/* POST bodies longer than this are truncated */
+const size_t http_max_post = 256 * 1024;
+
+/* Response bodies longer than this are truncated */
+const size_t http_max_response = 1024 * 1024;
+
+/* Status reported for a request which failed without a response, as the PHP worker did */
+const uint32_t http_status_failed = 999;
+
+const std::string http_user_agent = "Sporks/1.2";
+
+struct http_request {
+	/* GET or POST */
+	std::string method;
+	std::string url;
+	std::string postdata;
+};
+
+struct http_response {
+	/* HTTP status code, or http_status_failed */
+	uint32_t status;
+	std::string body;
+	/* Reason for failure, empty on success */
+	std::string error;
+};
+
+typedef std::function<void(const http_response&)> http_callback;
+
+/* The parts of a URL needed to make a request */
+struct http_url {
+	bool https;
+	std::string host;
+	std::string port;
+	/* Path and query string, always starting with a slash */
+	std::string path;
+};
+
+/**
+ * A small asynchronous HTTP/HTTPS client for the get() and post() bindings. All requests run
+ * on a single thread of their own, so a slow website never holds up a script, and the
+ * callback is called on that thread when the request completes or fails.
+ *
+ * Only http and https URLs are accepted. HTTPS certificates are verified against the host
+ * name. Redirects are followed, up to http_max_redirects.
+ */
+class HTTPClient {
+	asio::io_context io;
+	asio::executor_work_guard<asio::io_context::executor_type> work;
+	asio::ssl::context ssl;
+	std::thread* thr_io;
+	std::atomic<uint64_t> active;
+
+	friend class http_fetch;
+
+public:
+	HTTPClient();
+
+	/* Abandons any requests still in progress, without calling their callbacks */
+	~HTTPClient();
+
+	/* Start a request. Returns false, without calling the callback, if the URL isn't acceptable. */
+	bool Fetch(const http_request &request, const http_callback &done);
+
+	/* Number of requests in progress */
+	uint64_t Active();
+
+	/* Split an http or https URL into its parts. Returns false for any other kind of URL. */
+	static bool ParseURL(const std::string &url, http_url &parsed);
+
+	/* Resolve a redirect's Location against the URL which was redirected */
+	static bool Redirect(const http_url &from, const std::string &location, http_url &to);
+};
@@ -24,23 +24,22 @@
 #include <sporks/stringops.h>
 #include <sporks/database.h>
 #include <sporks/modules.h>
+#include <sporks/regex.h>
 #include <thread>
+#include <atomic>
+#include <memory>
 #include <streambuf>
+#include <sstream>
 #include <fstream>
 #include <iostream>
 #include <chrono>
+#include <algorithm>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/time.h>
-
-extern int interrupt;
-int64_t current_context;
-aegis::guild* current_guild;
-static std::shared_ptr<spdlog::logger> c_apis_suck;
-std::unordered_map<int64_t, duk_context*> emptyref;
-std::unordered_map<int64_t, duk_context*> &contexts = emptyref;
-std::unordered_map<int64_t, size_t> total_allocated;
+#include <string.h>
+
 static Bot* botref;
+static JS* jsref;
 
 
 
@@ -51,75 +50,130 @@ const uint64_t timeout_voted = 20;
 
 
 
-uint64_t timeout = timeout_unvoted;
 const uint32_t message_limit = 5;
 
-uint32_t message_total = 0;
-extern timeval t_script_start;
-extern timeval t_script_now;
+/* Default number of JS worker threads, if js_workers isn't set in the config */
+const size_t default_js_workers = 4;
 
-void sandbox_fatal(void *udata, const char *msg);
-void sandbox_free(void *udata, void *ptr);
-void *sandbox_alloc(void *udata, duk_size_t size);
-static void *sandbox_realloc(void *udata, void *ptr, duk_size_t size);
 std::string Sanitise(const std::string &s);
+std::string CleanErrorMessage(const std::string &error);
 
-struct program
+/* A channel's script. A bad directive is reported through compile_error, the same as a syntax error. */
+struct program : public sandbox_script
 {
-	std::string name;
-	std::string source;
-};
-
-std::unordered_map<int64_t, program> code;
-
-struct alloc_hdr {
-	/* The double value in the union is there to ensure alignment is
-	 * good for IEEE doubles too.  In many 32-bit environments 4 bytes
-	 * would be sufficiently aligned and the double value is unnecessary.
-	 */
-	union {
-		size_t sz;
-		double d;
-	} u;
+	/* Events the script runs for, and the filters an event must pass first, from its directives */
+	uint32_t events;
+	std::string prefix;
+	std::shared_ptr<PCRE> match;
+	std::vector<int64_t> roles;
 };
 
-static size_t max_allocated = max_allocated_unvoted;  /* 256kB sandbox */
-
-
-class ExitException : public std::exception {
+/* Programs of every channel which has a script, by channel id. This is also the set of channels
+ * which have JS. When a script changes its program is replaced rather than modified, so a run
+ * already holding the old one is unaffected.
+ */
+std::unordered_map<int64_t, std::shared_ptr<program>> code;
+std::mutex code_mutex;
+
+/* Backtracking allowed per @sporks-match test. The filter runs on the gateway thread outside
+ * the sandbox's time limit, so a pathological pattern must fail fast rather than stall it.
+ */
+const unsigned long directive_match_limit = 10000;
+
+/* Event names as used in @sporks-events, and as the EVENT global seen by the script */
+static const std::pair<const char*, js_event> event_names[] = {
+	{ "message", je_message },
+	{ "message_update", je_message_update },
+	{ "reaction_add", je_reaction_add },
+	{ "reaction_remove", je_reaction_remove },
+	{ "member_add", je_member_add },
 };
 
-static void define_func(duk_context* ctx, const std::string &name, duk_c_function func, int nargs)
-{
-	duk_push_string(ctx, name.c_str());
-	duk_push_c_function(ctx, func, nargs);
-	duk_def_prop(ctx, -3, DUK_DEFPROP_HAVE_VALUE);
-}
-
-static void define_number(duk_context* ctx, const std::string &name, duk_double_t num)
+static const char* event_name(js_event event)
 {
-	duk_push_string(ctx, name.c_str());
-	duk_push_number(ctx, num);
-	duk_def_prop(ctx, -3, DUK_DEFPROP_HAVE_VALUE);
+	for (auto & e : event_names) {
+		if (e.second == event) {
+			return e.first;
+		}
+	}
+	return "";
 }
 
-static void define_string(duk_context* ctx, const std::string &name, const std::string &value)
+/**
+ * Read the directives from a script's comments, which say which events it wants and filter
+ * them before a heap is ever used:
+ *
+ *   // @sporks-events message reaction_add member_add
+ *   // @sporks-prefix !roll
+ *   // @sporks-match ^!(roll|dice)\b
+ *   // @sporks-role 123456789012345678 234567890123456789
+ *
+ * A script without @sporks-events runs for messages only, as every script did before. Only
+ * real edits count as message_update: the partial updates Discord sends when it unfurls a
+ * link carry no author or content, and never run a script. The prefix and match filters apply
+ * to the content of messages and edited messages, and the role filter requires the author, reacting user or new member to have at least one of the roles.
+ * A match which exceeds directive_match_limit counts as not matching. A bad directive is
+ * reported the same way as a syntax error.
+ */
+static void parse_directives(program &p)
 {
-	duk_push_string(ctx, name.c_str());
-	duk_push_string(ctx, value.c_str());
-	duk_def_prop(ctx, -3, DUK_DEFPROP_HAVE_VALUE);
+	p.events = 0;
+	std::stringstream source(p.source);
+	std::string line;
+	while (std::getline(source, line)) {
+		line = trim(line);
+		if (line.substr(0, 2) != "//") {
+			continue;
+		}
+		std::stringstream tokens(trim(line.substr(2)));
+		std::string directive;
+		tokens >> directive;
+		std::string rest;
+		std::getline(tokens, rest);
+		rest = trim(rest);
+		if (directive == "@sporks-events") {
+			std::stringstream names(ReplaceString(rest, ",", " "));
+			std::string name;
+			while (names >> name) {
+				auto e = std::find_if(std::begin(event_names), std::end(event_names), [&name](const std::pair<const char*, js_event> &n) { return name == n.first; });
+				if (e == std::end(event_names)) {
+					p.compile_error = "Unknown event '" + name + "' in @sporks-events";
+					return;
+				}
+				p.events |= e->second;
+			}
+		} else if (directive == "@sporks-prefix") {
+			p.prefix = rest;
+		} else if (directive == "@sporks-match") {
+			try {
+				p.match = std::make_shared<PCRE>(rest);
+				p.match->SetMatchLimit(directive_match_limit);
+			}
+			catch (const regex_exception &e) {
+				p.compile_error = "Invalid @sporks-match pattern: " + e.message;
+				return;
+			}
+		} else if (directive == "@sporks-role") {
+			std::stringstream ids(ReplaceString(rest, ",", " "));
+			int64_t id;
+			while (ids >> id) {
+				p.roles.push_back(id);
+			}
+		}
+	}
+	if (p.events == 0) {
+		p.events = je_message;
+	}
 }
 
-static duk_ret_t js_print(duk_context *cx)
+static std::shared_ptr<program> make_program(int64_t channel_id, const std::string &source, bool profiling)
 {
-	int argc = duk_get_top(cx);
-	std::string output;
-	if (argc < 1)
-		return 0;
-	for (int i = 0; i < argc; i++)
-		output.append(duk_to_string(cx, i - argc)).append(" ");
-	c_apis_suck->debug("JS debuglog(): {}", trim(output));
-	return 0;
+	std::shared_ptr<program> p = std::make_shared<program>();
+	p->name = std::to_string(channel_id) + ".js";
+	p->source = source;
+	p->profiling = profiling;
+	parse_directives(*p);
+	return p;
 }
 
 static void duk_build_object(duk_context* cx, const std::map<std::string, std::string> &strings, const std::map<std::string, bool> &bools)
@@ -139,22 +193,23 @@ static void duk_build_object(duk_context* cx, const std::map<std::string, std::s
 
 static duk_ret_t js_create_message(duk_context *cx)
 {
+	sandbox_context* context = sandbox_get_context(cx);
 	int argc = duk_get_top(cx);
 	std::string output;
 	if (argc < 2)
 		return 0;
 	if (!duk_is_string(cx, 0)) {
-		c_apis_suck->warn("JS create_message(): parameter 1 is not a string");
+		sandbox_log->warn("JS create_message(): parameter 1 is not a string");
 		return 0;
 	}
 	std::string id = duk_get_string(cx, 0);
-	aegis::channel* c = current_guild->find_channel(from_string<int64_t>(id, std::dec));
+	aegis::channel* c = context->guild->find_channel(from_string<int64_t>(id, std::dec));
 	if (c) {
 		for (int i = 1; i < argc; i++) {
 			output.append(duk_to_string(cx, i - argc)).append(" ");
 		}
 		std::string message = trim(output);
-		if (message_total >= message_limit) {
+		if (context->message_total >= message_limit) {
 			duk_push_error_object(cx, DUK_ERR_RANGE_ERROR, "Message limit reached");
 			return duk_throw(cx);
 		}
@@ -162,72 +217,74 @@ static duk_ret_t js_create_message(duk_context *cx)
 			c->create_message(Sanitise(message));
 			botref->sent_messages++;
 		}
-		message_total++;
-		c_apis_suck->debug("JS create_message() on guild={}/channel={}: {}", current_guild->get_id(), id, message);
+		context->message_total++;
+		sandbox_log->debug("JS create_message() on guild={}/channel={}: {}", context->guild->get_id(), id, message);
 	} else {
-		c_apis_suck->warn("JS create_message(): invalid channel id: {}", id);
+		sandbox_log->warn("JS create_message(): invalid channel id: {}", id);
 	}
 	return 0;
 }
 
 static duk_ret_t js_add_reaction(duk_context *cx)
 {
+	sandbox_context* context = sandbox_get_context(cx);
 	int argc = duk_get_top(cx);
 	std::string output;
 	if (argc < 3)
 		return 0;
 	if (!duk_is_string(cx, 0)) {
-		c_apis_suck->warn("JS add_reaction(): parameter 1 is not a string");
+		sandbox_log->warn("JS add_reaction(): parameter 1 is not a string");
 		return 0;
 	}
 	if (!duk_is_string(cx, -1)) {
-		c_apis_suck->warn("JS add_reaction(): parameter 2 is not a string");
+		sandbox_log->warn("JS add_reaction(): parameter 2 is not a string");
 		return 0;
 	}
 	if (!duk_is_string(cx, -2)) {
-		c_apis_suck->warn("JS add_reaction(): parameter 3 is not a string");
+		sandbox_log->warn("JS add_reaction(): parameter 3 is not a string");
 		return 0;
 	}	
 	std::string id = duk_get_string(cx, 0);
 	std::string message_id = duk_get_string(cx, -2);
 	std::string emoji = duk_get_string(cx, -1);
-	aegis::channel* c = current_guild->find_channel(from_string<int64_t>(id, std::dec));
+	aegis::channel* c = context->guild->find_channel(from_string<int64_t>(id, std::dec));
 	if (c) {
 		c->create_reaction(from_string<int64_t>(message_id, std::dec), trim(emoji));
-		c_apis_suck->debug("JS add_reaction() on guild={}/channel={}: msg id={} emoji={}", current_guild->get_id(), id, message_id, emoji);
+		sandbox_log->debug("JS add_reaction() on guild={}/channel={}: msg id={} emoji={}", context->guild->get_id(), id, message_id, emoji);
 	} else {
-		c_apis_suck->warn("JS add_reaction(): invalid channel id: {}", id);
+		sandbox_log->warn("JS add_reaction(): invalid channel id: {}", id);
 	}
 	return 0;
 }
 
 static duk_ret_t js_delete_reaction(duk_context *cx)
 {
+	sandbox_context* context = sandbox_get_context(cx);
 	int argc = duk_get_top(cx);
 	std::string output;
 	if (argc < 3)
 		return 0;
 	if (!duk_is_string(cx, 0)) {
-		c_apis_suck->warn("JS delete_reaction(): parameter 1 is not a string");
+		sandbox_log->warn("JS delete_reaction(): parameter 1 is not a string");
 		return 0;
 	}
 	if (!duk_is_string(cx, -1)) {
-		c_apis_suck->warn("JS delete_reaction(): parameter 2 is not a string");
+		sandbox_log->warn("JS delete_reaction(): parameter 2 is not a string");
 		return 0;
 	}
 	if (!duk_is_string(cx, -2)) {
-		c_apis_suck->warn("JS delete_reaction(): parameter 3 is not a string");
+		sandbox_log->warn("JS delete_reaction(): parameter 3 is not a string");
 		return 0;
 	}
 	std::string id = duk_get_string(cx, 0);
 	std::string message_id = duk_get_string(cx, -2);
 	std::string emoji = duk_get_string(cx, -1);
-	aegis::channel* c = current_guild->find_channel(from_string<int64_t>(id, std::dec));
+	aegis::channel* c = context->guild->find_channel(from_string<int64_t>(id, std::dec));
 	if (c) {
 		c->delete_own_reaction(from_string<int64_t>(message_id, std::dec), trim(emoji));
-		c_apis_suck->debug("JS delete_reaction() on guild={}/channel={}: msg_id={} emoji={}", current_guild->get_id(), id, message_id, emoji);
+		sandbox_log->debug("JS delete_reaction() on guild={}/channel={}: msg_id={} emoji={}", context->guild->get_id(), id, message_id, emoji);
 	} else {
-		c_apis_suck->warn("JS delete_reaction(): invalid channel id: {}", id);
+		sandbox_log->warn("JS delete_reaction(): invalid channel id: {}", id);
 	}
 	return 0;
 }
@@ -238,26 +295,27 @@ std::string Sanitise(const std::string &s) {
 
 static duk_ret_t js_create_embed(duk_context *cx)
 {
+	sandbox_context* context = sandbox_get_context(cx);
 	int argc = duk_get_top(cx);
 	std::string output;
 	if (argc != 2)
 		return 0;
 	if (!duk_is_string(cx, 0)) {
-		c_apis_suck->warn("JS create_embed(): parameter 1 is not a string");
+		sandbox_log->warn("JS create_embed(): parameter 1 is not a string");
 		return 0;
 	}
 	if (!duk_is_object(cx, -1)) {
-		c_apis_suck->warn("JS create_embed(): parameter 2 is not an object");
+		sandbox_log->warn("JS create_embed(): parameter 2 is not an object");
 		return 0;
 	}
 	std::string id = duk_get_string(cx, 0);
 	std::string j = duk_json_encode(cx, -1);
-	aegis::channel* c = current_guild->find_channel(from_string<int64_t>(id, std::dec));
+	aegis::channel* c = context->guild->find_channel(from_string<int64_t>(id, std::dec));
 	if (c) {
 		json embed;
 		try {
 			embed = json::parse(Sanitise(j));
-			if (message_total >= message_limit) {
+			if (context->message_total >= message_limit) {
 				duk_push_error_object(cx, DUK_ERR_RANGE_ERROR, "Message limit reached");
 				return duk_throw(cx);
 			}
@@ -265,29 +323,20 @@ static duk_ret_t js_create_embed(duk_context *cx)
 				c->create_message_embed("", embed);
 				botref->sent_messages++;
 			}
-			message_total++;
-			c_apis_suck->debug("JS create_embed() on guild={}/channel={}: {}", current_guild->get_id(), id, j);
+			context->message_total++;
+			sandbox_log->debug("JS create_embed() on guild={}/channel={}: {}", context->guild->get_id(), id, j);
 		} catch (const std::exception &e) {
-			c_apis_suck->error("JS create_embed() JSON parse exception {}", e.what());
+			sandbox_log->error("JS create_embed() JSON parse exception {}", e.what());
 		}
 	} else {
-		c_apis_suck->warn("JS create_message(): invalid channel id: {}", id);
+		sandbox_log->warn("JS create_message(): invalid channel id: {}", id);
 	}
 	return 0;
 }
 
-void do_web_request(const std::string &reqtype, const std::string &url, const std::string &callback, const std::string &postdata = "")
+void do_web_request(sandbox_context* context, const std::string &reqtype, const std::string &url, const std::string &callback, const std::string &postdata = "")
 {
-	
-	db::resultset rs = db::query("SELECT count(guild_id) AS count1 FROM infobot_web_requests WHERE guild_id = ?", {std::to_string(current_guild->get_id())});
-	if (rs[0]["count1"] == "0") {
-		db::resultset rs = db::query("SELECT count(channel_id) AS count2 FROM infobot_web_requests WHERE guild_id = ?", {std::to_string(current_context)});
-		if (rs[0]["count2"] == "0") {
-			c_apis_suck->debug("JS web request created on guild={}/channel={}: {}", current_guild->get_id(), current_context, url);
-			db::resultset rs = db::query("INSERT INTO infobot_web_requests (channel_id, guild_id, url, type, postdata, callback) VALUES('?','?','?','?','?','?')",
-					{std::to_string(current_context), std::to_string(current_guild->get_id()), url, reqtype, postdata, callback});
-		}
-	}
+	jsref->WebRequest(context->channel_id, context->guild->get_id(), reqtype, url, callback, postdata);
 }
 
 static duk_ret_t js_get(duk_context *cx)
@@ -295,16 +344,16 @@ static duk_ret_t js_get(duk_context *cx)
 	/* url, callback */
 	int argc = duk_get_top(cx);
 	if (argc != 2) {
-		c_apis_suck->warn("JS get(): incorrect number of parameters: {}", argc);
+		sandbox_log->warn("JS get(): incorrect number of parameters: {}", argc);
 		return 0;
 	}
 	if (!duk_is_string(cx, 0) || !duk_is_string(cx, -1)) {
-		c_apis_suck->warn("JS post(): parameters are not strings!");
+		sandbox_log->warn("JS post(): parameters are not strings!");
 		return 0;
 	}
 	std::string url = duk_get_string(cx, 0);
 	std::string callback = duk_get_string(cx, -1);
-	do_web_request("GET", url, callback);
+	do_web_request(sandbox_get_context(cx), "GET", url, callback);
 	return 0;
 }
 
@@ -312,35 +361,36 @@ static duk_ret_t js_post(duk_context *cx)
 {
 	int argc = duk_get_top(cx);
 	if (argc != 3) {
-		c_apis_suck->warn("JS post(): incorrect number of parameters: {}", argc);
+		sandbox_log->warn("JS post(): incorrect number of parameters: {}", argc);
 		return 0;
 	}
 	if (!duk_is_string(cx, 0) || !duk_is_string(cx, -1) || !duk_is_string(cx, -2)) {
-		c_apis_suck->warn("JS post(): parameters are not strings!");
+		sandbox_log->warn("JS post(): parameters are not strings!");
 		return 0;
 	}
 	std::string url = duk_get_string(cx, 0);
 	std::string postdata = duk_get_string(cx, -1);
 	std::string callback = duk_get_string(cx, -2);
-	do_web_request("POST", url, callback, postdata);
+	do_web_request(sandbox_get_context(cx), "POST", url, callback, postdata);
 	return 0;
 }
 
 static duk_ret_t js_find_user(duk_context *cx)
 {
+	sandbox_context* context = sandbox_get_context(cx);
 	int argc = duk_get_top(cx);
 	if (argc != 1) {
-		c_apis_suck->warn("JS find_user(): incorrect number of parameters: {}", argc);
+		sandbox_log->warn("JS find_user(): incorrect number of parameters: {}", argc);
 		return 0;
 	}
 	if (!duk_is_string(cx, -1)) {
-		c_apis_suck->warn("JS find_user(): parameter is not a string");
+		sandbox_log->warn("JS find_user(): parameter is not a string");
 		return 0;
 	}
 	std::string id = duk_get_string(cx, -1);
-	aegis::user* u = current_guild->find_member(from_string<int64_t>(id, std::dec));
+	aegis::user* u = context->guild->find_member(from_string<int64_t>(id, std::dec));
 	if (u) {
-		std::string nickname = u->get_name(current_guild->get_id());
+		std::string nickname = u->get_name(context->guild->get_id());
 		duk_build_object(cx, {
 			{ "id", std::to_string(u->get_id()) },
 			{ "username", u->get_username() },
@@ -360,53 +410,70 @@ static duk_ret_t js_find_user(duk_context *cx)
 
 static duk_ret_t js_find_username(duk_context *cx)
 {
+	sandbox_context* context = sandbox_get_context(cx);
 	int argc = duk_get_top(cx);
 	if (argc != 1) {
-		c_apis_suck->warn("JS find_username(): incorrect number of parameters: {}", argc);
+		sandbox_log->warn("JS find_username(): incorrect number of parameters: {}", argc);
 		return 0;
 	}
 	if (!duk_is_string(cx, -1)) {
-		c_apis_suck->warn("JS find_username(): parameter is not a string");
+		sandbox_log->warn("JS find_username(): parameter is not a string");
 		return 0;
 	}
 	std::string username = lowercase(std::string(duk_get_string(cx, -1)));
-	/* Yeah this sucks and is O(n). Until aegis provides a better way of looking up a guild member by
-	 * anything other than snowflake id, this will have to do
-	 */
-	for (auto u = current_guild->get_members().begin(); u != current_guild->get_members().end(); ++u) {
-		if (lowercase(u->second->get_full_name()) == username) {
-			std::string nickname = u->second->get_name(current_guild->get_id());
-			duk_build_object(cx, {
-				{ "id", std::to_string(u->second->get_id()) },
-				{ "username", u->second->get_username() },
-				{ "discriminator", std::to_string(u->second->get_discriminator()) },
-				{ "avatar", u->second->get_avatar() },
-				{ "mention", u->second->get_mention() },
-				{ "full_name", u->second->get_full_name() },
-				{ "nickname", nickname }
-			}, {
-				{ "bot", u->second->is_bot() },
-				{ "mfa_enabled", u->second->is_mfa_enabled() }
-			});
-			return 1;
+	aegis::user* found = nullptr;
+	std::vector<int64_t> ids;
+	if (botref->names.HasGuild(context->guild->get_id().get())) {
+		/* Names are indexed by the bot, but aegis has the final say on what a member is called now */
+		botref->names.FindFullName(context->guild->get_id().get(), username, ids);
+		for (auto id = ids.begin(); id != ids.end() && !found; ++id) {
+			aegis::user* u = context->guild->find_member(*id);
+			if (u && lowercase(u->get_full_name()) == username) {
+				found = u;
+			}
 		}
+	} else {
+		/* Guild not indexed yet, fall back to a scan */
+		for (auto u = context->guild->get_members().begin(); u != context->guild->get_members().end(); ++u) {
+			if (lowercase(u->second->get_full_name()) == username) {
+				found = u->second;
+				break;
+			}
+		}
+	}
+	if (found) {
+		std::string nickname = found->get_name(context->guild->get_id());
+		duk_build_object(cx, {
+			{ "id", std::to_string(found->get_id()) },
+			{ "username", found->get_username() },
+			{ "discriminator", std::to_string(found->get_discriminator()) },
+			{ "avatar", found->get_avatar() },
+			{ "mention", found->get_mention() },
+			{ "full_name", found->get_full_name() },
+			{ "nickname", nickname }
+		}, {
+			{ "bot", found->is_bot() },
+			{ "mfa_enabled", found->is_mfa_enabled() }
+		});
+		return 1;
 	}
 	return 0;
 }
 
 static duk_ret_t js_find_channel(duk_context *cx)
 {
+	sandbox_context* context = sandbox_get_context(cx);
 	int argc = duk_get_top(cx);
 	if (argc != 1) {
-		c_apis_suck->warn("JS find_channel(): incorrect number of parameters: {}", argc);
+		sandbox_log->warn("JS find_channel(): incorrect number of parameters: {}", argc);
 		return 0;
 	}
 	if (!duk_is_string(cx, -1)) {
-		c_apis_suck->warn("JS find_channel(): parameter is not a string");
+		sandbox_log->warn("JS find_channel(): parameter is not a string");
 		return 0;
 	}
 	std::string id = duk_get_string(cx, -1);
-	aegis::channel* c = current_guild->find_channel(from_string<int64_t>(id, std::dec));
+	aegis::channel* c = context->guild->find_channel(from_string<int64_t>(id, std::dec));
 	if (c) {
 		duk_build_object(cx, {
 			{ "id", std::to_string(c->get_id()) },
@@ -423,171 +490,393 @@ static duk_ret_t js_find_channel(duk_context *cx)
 	return 0;
 }
 
-static duk_ret_t js_load(duk_context *cx)
+static duk_ret_t js_find_channelname(duk_context *cx)
 {
+	sandbox_context* context = sandbox_get_context(cx);
 	int argc = duk_get_top(cx);
 	if (argc != 1) {
-		c_apis_suck->warn("JS load(): incorrect number of parameters: {}", argc);
+		sandbox_log->warn("JS find_channelname(): incorrect number of parameters: {}", argc);
 		return 0;
 	}
 	if (!duk_is_string(cx, -1)) {
-		c_apis_suck->warn("JS load(): parameter is not a string");
+		sandbox_log->warn("JS find_channelname(): parameter is not a string");
 		return 0;
 	}
-	std::string keyname = duk_get_string(cx, -1);
-	std::string guild_id = std::to_string(current_guild->get_id());
-	db::resultset rs = db::query("SELECT value FROM infobot_javascript_kv WHERE guild_id = ? AND keyname = '?'", {guild_id, keyname});
-	if (rs.size() == 1 && rs[0].find("value") != rs[0].end()) {
-		duk_push_string(cx, rs[0].find("value")->second.c_str());
-		return 1;
+	std::string channelname = lowercase(std::string(duk_get_string(cx, -1)));
+	aegis::channel* found = nullptr;
+	std::vector<int64_t> ids;
+	if (botref->names.HasGuild(context->guild->get_id().get())) {
+		botref->names.FindChannel(context->guild->get_id().get(), channelname, ids);
+		for (auto id = ids.begin(); id != ids.end() && !found; ++id) {
+			aegis::channel* c = context->guild->find_channel(*id);
+			if (c && lowercase(c->get_name()) == channelname) {
+				found = c;
+			}
+		}
 	} else {
-		return 0;
+		for (auto c = context->guild->get_channels().begin(); c != context->guild->get_channels().end(); ++c) {
+			if (lowercase(c->second->get_name()) == channelname) {
+				found = c->second;
+				break;
+			}
+		}
+	}
+	if (found) {
+		duk_build_object(cx, {
+			{ "id", std::to_string(found->get_id()) },
+			{ "name", found->get_name() },
+			{ "type", std::to_string(found->get_type()) },
+			{ "guild_id", std::to_string(found->get_guild_id()) },
+			{ "parent_id", std::to_string(found->get_parent_id()) }
+		}, {
+			{ "dm", found->is_dm() },
+			{ "nsfw", found->nsfw() }
+		});
+		return 1;
 	}
+	return 0;
 }
 
-static duk_ret_t js_delete(duk_context *cx)
+/* Every native function available to scripts. The index into this table is the function's magic number. */
+static const sandbox_binding bindings[] = {
+	{ "debuglog", sandbox_debuglog, DUK_VARARGS },
+	{ "find_user", js_find_user, 1 },
+	{ "find_channel", js_find_channel, 1 },
+	{ "create_message", js_create_message, DUK_VARARGS },
+	{ "create_embed", js_create_embed, 2 },
+	{ "find_username", js_find_username, 1 },
+	{ "find_channelname", js_find_channelname, 1 },
+	{ "save", sandbox_save, 2 },
+	{ "load", sandbox_load, 1 },
+	{ "delete", sandbox_delete, 1 },
+	{ "get", js_get, 2 },
+	{ "post", js_post, 3 },
+	{ "exit", sandbox_exit, 1 },
+	{ "add_reaction", js_add_reaction, 3 },
+	{ "delete_reaction", js_delete_reaction, 3 },
+};
+
+JS::JS(std::shared_ptr<spdlog::logger>& logger, Bot* thisbot) : log(logger), bot(thisbot), heaps(sandbox_alloc, sandbox_realloc, sandbox_free, sandbox_fatal)
 {
-	int argc = duk_get_top(cx);
-	if (argc != 1) {
-		c_apis_suck->warn("JS delete(): incorrect number of parameters: {}", argc);
-		return 0;
+	sandbox_log = log;
+	botref = bot;
+	jsref = this;
+	terminate = false;
+
+	size_t worker_count = default_js_workers;
+	try {
+		worker_count = std::max((size_t)1, from_string<size_t>(Bot::GetConfig("js_workers"), std::dec));
 	}
-	if (!duk_is_string(cx, -1)) {
-		c_apis_suck->warn("JS delete(): parameter is not a string");
-		return 0;
+	catch (const std::exception &e) {
+		/* Not configured, use the default */
 	}
-	std::string keyname = duk_get_string(cx, -1);
-	std::string guild_id = std::to_string(current_guild->get_id());
-	db::resultset rs = db::query("DELETE FROM infobot_javascript_kv WHERE guild_id = ? AND keyname = '?'", {guild_id, keyname});
-	return 0;
+	workers = new WorkerPool(worker_count);
+	log->info("Running JS on {} worker threads", workers->Size());
+
+	/* Created up front, so that workers only ever update existing entries */
+	bot->counters.Set("js_heaps_created", 0);
+	bot->counters.Set("js_heaps_reused", 0);
+
+	LoadScripts();
+
+	http = new HTTPClient();
+	script_watcher = new std::thread(&JS::ScriptWatch, this);
 }
 
-static duk_ret_t js_save(duk_context *cx)
+/**
+ * Clear a channel's dirty flag, but only if the script and profile flag are still the ones which
+ * were just loaded. If it was saved again since they were read, the flag stays set and the new
+ * version is picked up by the next poll. BINARY makes the comparison exact, as the column's
+ * collation would otherwise ignore changes of case and trailing spaces.
+ */
+static void clear_dirty(int64_t channel_id, const std::string &script, const std::string &profile)
 {
-	int argc = duk_get_top(cx);
-	if (argc != 2) {
-		c_apis_suck->warn("JS save(): incorrect number of parameters: {}", argc);
-		return 0;
-	}
-	if (!duk_is_string(cx, 0)) {
-		c_apis_suck->warn("JS save(): first parameter is not a string");
-		return 0;
-	}
-	if (!duk_is_string(cx, -1)) {
-		c_apis_suck->warn("JS save(): second parameter is not a string");
-		return 0;
-	}
-	std::string keyname = duk_get_string(cx, 0);
-	std::string value = duk_get_string(cx, -1);
-	std::string guild_id = std::to_string(current_guild->get_id());
-	db::query("INSERT INTO infobot_javascript_kv (guild_id, keyname, value) VALUES(?,'?','?') ON DUPLICATE KEY UPDATE value ='?'", {guild_id, keyname, value, value});
-	return 0;
+	db::execute("UPDATE infobot_discord_javascript SET dirty = 0 WHERE id = ? AND dirty = 1 AND BINARY IFNULL(script, '') = '?' AND profile = '?'", {channel_id, script, profile});
 }
 
-static duk_ret_t js_exit(duk_context *cx)
+/**
+ * Load every channel's script. There are only ever a small number of channels with JS, so
+ * this is cheap enough to do at startup and whenever a channel gains or loses a script.
+ */
+void JS::LoadScripts()
 {
-	int argc = duk_get_top(cx);
-	if (argc != 1) {
-		c_apis_suck->warn("JS exit(): incorrect number of parameters: {}", argc);
+	db::resultset rs, summary;
+	if (!db::query("SELECT id, script, profile, dirty FROM infobot_discord_javascript", {}, rs) ||
+		!db::query("SELECT COUNT(id) AS total, MAX(created) AS newest FROM infobot_discord_javascript", {}, summary)) {
+		log->error("Can't load JS channels: {}", db::error());
+		return;
+	}
+
+	/* Only this thread replaces programs, so the current set can be read now and swapped later */
+	std::unordered_map<int64_t, std::shared_ptr<program>> current;
+	{
+		std::lock_guard<std::mutex> code_lock(code_mutex);
+		current = code;
+	}
+
+	std::unordered_map<int64_t, std::shared_ptr<program>> loaded;
+	size_t compiled = 0;
+	for (auto i = rs.begin(); i != rs.end(); ++i) {
+		int64_t channel_id = from_string<int64_t>((*i)["id"], std::dec);
+		auto existing = current.find(channel_id);
+		/* Unchanged scripts keep their compiled code */
+		if (existing != current.end() && existing->second->source == (*i)["script"]) {
+			loaded[channel_id] = existing->second;
+			existing->second->profiling = ((*i)["profile"] == "1");
+		} else {
+			loaded[channel_id] = make_program(channel_id, (*i)["script"], (*i)["profile"] == "1");
+			Precompile(channel_id, *loaded[channel_id]);
+			compiled++;
+		}
+	}
+	{
+		std::lock_guard<std::mutex> code_lock(code_mutex);
+		code.swap(loaded);
 	}
-	throw ExitException();
+	channel_summary = summary.size() ? summary[0]["total"] + "/" + summary[0]["newest"] : "";
+	/* Anything which was flagged as dirty has just been loaded */
+	for (auto i = rs.begin(); i != rs.end(); ++i) {
+		if ((*i)["dirty"] == "1") {
+			clear_dirty(from_string<int64_t>((*i)["id"], std::dec), (*i)["script"], (*i)["profile"]);
+		}
+	}
+	log->info("Loaded JS for {} channels, {} compiled", rs.size(), compiled);
 }
 
-static duk_ret_t js_find_channelname(duk_context *cx)
+/**
+ * Compile a program's main script before it is published, so that runs only ever load bytecode,
+ * and syntax errors are reported as soon as the script is saved rather than when a message
+ * next arrives. The compile time and any error are recorded in the channel's statistics.
+ */
+bool JS::Precompile(int64_t channel_id, program &p)
 {
-	int argc = duk_get_top(cx);
-	if (argc != 1) {
-		c_apis_suck->warn("JS find_channelname(): incorrect number of parameters: {}", argc);
-		return 0;
+	if (!p.compile_error.empty()) {
+		/* Bad directive */
+		telemetry.RecordCompile(channel_id, 0, p.compile_error);
+		return false;
 	}
-	if (!duk_is_string(cx, -1)) {
-		c_apis_suck->warn("JS find_channelname(): parameter is not a string");
-		return 0;
+	sandbox_heap* heap = heaps.Acquire(max_allocated_voted);
+	if (!heap) {
+		/* The first run will compile it instead */
+		log->error("JS::Precompile() Can't create a heap for channel {}", channel_id);
+		return false;
 	}
-	std::string channelname = lowercase(std::string(duk_get_string(cx, -1)));
-	for (auto c = current_guild->get_channels().begin(); c != current_guild->get_channels().end(); ++c) {
-		if (lowercase(c->second->get_name()) == channelname) {
-			duk_build_object(cx, {
-				{ "id", std::to_string(c->second->get_id()) },
-				{ "name", c->second->get_name() },
-				{ "type", std::to_string(c->second->get_type()) },
-				{ "guild_id", std::to_string(c->second->get_guild_id()) },
-				{ "parent_id", std::to_string(c->second->get_parent_id()) }
-			}, {
-				{ "dm", c->second->is_dm() },
-				{ "nsfw", c->second->nsfw() }
-			});
-			return 1;
-		}
+	auto t_start = std::chrono::high_resolution_clock::now();
+	if (!sandbox_compile(heap, p)) {
+		p.compile_error = CleanErrorMessage(p.compile_error);
+		log->debug("JS for channel {} doesn't compile: {}", channel_id, p.compile_error);
 	}
-	return 0;
+	auto t_end = std::chrono::high_resolution_clock::now();
+	heaps.Release(heap);
+	telemetry.RecordCompile(channel_id, std::chrono::duration<double, std::milli>(t_end-t_start).count(), p.compile_error);
+	return p.compile_error.empty();
 }
 
-JS::JS(std::shared_ptr<spdlog::logger>& logger, Bot* thisbot) : log(logger), bot(thisbot)
+/**
+ * Watches for script changes. The dashboard sets dirty when it changes a script; the dirty
+ * column is indexed so checking it is a cheap lookup. A channel gaining or losing a script
+ * shows up as a change in the number of rows or the newest creation date, in which case the
+ * whole set is reloaded.
+ */
+void JS::ScriptWatch()
 {
-	terminate = false;
-	web_request_watcher = new std::thread(&JS::WebRequestWatch, this);
+	while (!this->terminate) {
+		std::this_thread::sleep_for(std::chrono::seconds(js_script_poll_seconds));
+
+		db::resultset summary = db::query("SELECT COUNT(id) AS total, MAX(created) AS newest FROM infobot_discord_javascript", {});
+		if (summary.size() && summary[0]["total"] + "/" + summary[0]["newest"] != channel_summary) {
+			LoadScripts();
+			continue;
+		}
+
+		db::resultset rs = db::query("SELECT id, script, profile FROM infobot_discord_javascript WHERE dirty = 1", {});
+		for (auto i = rs.begin(); i != rs.end(); ++i) {
+			int64_t channel_id = from_string<int64_t>((*i)["id"], std::dec);
+			log->info("Reloading JS for channel {}", channel_id);
+			std::shared_ptr<program> existing;
+			{
+				std::lock_guard<std::mutex> code_lock(code_mutex);
+				auto e = code.find(channel_id);
+				if (e != code.end()) {
+					existing = e->second;
+				}
+			}
+			/* Compiled code is only thrown away if the script actually changed. A changed script is
+			 * compiled here, then swapped in whole, so a run never sees it half built.
+			 */
+			if (!existing || existing->source != (*i)["script"]) {
+				std::shared_ptr<program> p = make_program(channel_id, (*i)["script"], (*i)["profile"] == "1");
+				Precompile(channel_id, *p);
+				std::lock_guard<std::mutex> code_lock(code_mutex);
+				code[channel_id] = p;
+			} else {
+				existing->profiling = ((*i)["profile"] == "1");
+			}
+			clear_dirty(channel_id, (*i)["script"], (*i)["profile"]);
+		}
+	}
 }
 
-void JS::WebRequestWatch()
+/**
+ * Start a web request for a script. Only one request per guild may be in progress at a time.
+ * When it completes, the callback function named by the script is queued to run on the
+ * channel's worker with the response body (empty if the request failed) as WCB_CONTENT.
+ */
+bool JS::WebRequest(int64_t channel_id, int64_t guild_id, const std::string &method, const std::string &url, const std::string &callback, const std::string &postdata)
 {
-	while (!this->terminate)
 	{
-		db::resultset rs = db::query("SELECT * FROM infobot_web_requests WHERE statuscode != '000'", {});
-		for (auto i = rs.begin(); i != rs.end(); ++i) {
-			c_apis_suck->debug("JS web request response received for url {}", (*i)["url"]);
-			run(from_string<int64_t>((*i)["channel_id"], std::dec), {}, (*i)["callback"], (*i)["returndata"]);
-			db::query("DELETE FROM infobot_web_requests WHERE channel_id = ?", {(*i)["channel_id"]});
+		std::lock_guard<std::mutex> web_lock(web_mutex);
+		if (terminate) {
+			/* Unloading, and this is a queued script being drained */
+			return false;
+		}
+		if (web_guilds.find(guild_id) != web_guilds.end()) {
+			log->debug("JS web request refused on guild={}/channel={}, a request is already in progress: {}", guild_id, channel_id, url);
+			return false;
 		}
-		std::this_thread::sleep_for(std::chrono::seconds(1));
+		web_guilds.insert(guild_id);
 	}
+
+	log->debug("JS web request created on guild={}/channel={}: {}", guild_id, channel_id, url);
+	bool started = http->Fetch({ method, url, postdata }, [this, channel_id, guild_id, url, callback](const http_response &response) {
+		if (response.error.empty()) {
+			log->debug("JS web request response received for url {}: {}", url, response.status);
+		} else {
+			log->debug("JS web request for url {} failed: {}", url, response.error);
+		}
+		/* Queued under the lock, so that the destructor can't delete the workers in between */
+		std::lock_guard<std::mutex> web_lock(web_mutex);
+		web_guilds.erase(guild_id);
+		if (!terminate) {
+			Queue(channel_id, {}, callback, response.body);
+		}
+	});
+
+	if (!started) {
+		/* Not an http or https URL. The callback still runs, with nothing, as it always has. */
+		log->debug("JS web request for invalid url {}", url);
+		std::lock_guard<std::mutex> web_lock(web_mutex);
+		web_guilds.erase(guild_id);
+		if (!terminate) {
+			Queue(channel_id, {}, callback, "");
+		}
+	}
+	return started;
 }
 
+/**
+ * Once terminate is set, no web request completion queues a callback and no script starts a
+ * new request, so the queued scripts can be drained before the HTTP client they use is freed.
+ */
 JS::~JS()
 {
-	terminate = true;
-	if (web_request_watcher->joinable()) {
-		web_request_watcher->join();
+	{
+		std::lock_guard<std::mutex> web_lock(web_mutex);
+		terminate = true;
 	}
-	delete web_request_watcher;
+	if (script_watcher->joinable()) {
+		script_watcher->join();
+	}
+	delete script_watcher;
+	/* Finishes any queued scripts before returning */
+	delete workers;
+	delete http;
 }
 
 bool JS::channelHasJS(int64_t channel_id)
 {
-	db::resultset r = db::query("SELECT id FROM infobot_discord_javascript WHERE id = ?", {std::to_string(channel_id)});
-	/* No javascript configuration for this channel */
-	if (r.size() == 0) {
-		return false;
-	} else {
-		return true;
-	}
+	std::lock_guard<std::mutex> code_lock(code_mutex);
+	return code.find(channel_id) != code.end();
 }
 
-bool JS::hasReplied()
+/**
+ * Decide from a channel's directives whether an event should run its script at all. This is
+ * cheap enough to call for every event, so events a script didn't ask for never touch a heap.
+ */
+bool JS::Wants(int64_t channel_id, js_event event, const std::string &content, aegis::guild* guild, int64_t user_id)
 {
-	return message_total > 0;
+	std::shared_ptr<program> p;
+	{
+		std::lock_guard<std::mutex> code_lock(code_mutex);
+		auto iter = code.find(channel_id);
+		if (iter == code.end()) {
+			return false;
+		}
+		p = iter->second;
+	}
+	if (!(p->events & event)) {
+		return false;
+	}
+	if (event == je_message || event == je_message_update) {
+		if (!p->prefix.empty() && content.compare(0, p->prefix.length(), p->prefix) != 0) {
+			return false;
+		}
+		if (p->match && !p->match->Match(content)) {
+			return false;
+		}
+	}
+	if (!p->roles.empty()) {
+		if (!guild) {
+			return false;
+		}
+		return std::any_of(p->roles.begin(), p->roles.end(), [guild, user_id](int64_t role) { return guild->member_has_role(user_id, role); });
+	}
+	return true;
 }
 
 std::string CleanErrorMessage(const std::string &error) {
 	return ReplaceString(error, "    at [anon] (duk_js_var.c:1234) internal\n", "");
 }
 
-bool JS::run(int64_t channel_id, const std::unordered_map<std::string, json> &vars, const std::string &callback_fn, const std::string &callback_content)
+/**
+ * Scripts for the same channel always go to the same worker, so they run one at a time and in
+ * the order their events arrived, and a channel's program is only ever touched by one thread.
+ */
+std::future<bool> JS::Queue(int64_t channel_id, const std::unordered_map<std::string, json> &vars, const std::string &callback_fn, const std::string &callback_content)
+{
+	auto task = std::make_shared<std::packaged_task<bool()>>([this, channel_id, vars, callback_fn, callback_content]() {
+		bool replied = false;
+		run(channel_id, vars, callback_fn, callback_content, &replied);
+		return replied;
+	});
+	std::future<bool> replied = task->get_future();
+	workers->Submit(channel_id, [task]() {
+		(*task)();
+	});
+	return replied;
+}
+
+bool JS::run(int64_t channel_id, const std::unordered_map<std::string, json> &vars, const std::string &callback_fn, const std::string &callback_content, bool* replied)
 {
-	std::lock_guard<std::mutex> input_lock(this->jsmutex);
-	duk_int_t ret;
-	int i;
+	size_t max_allocated;
+	uint64_t timeout;
+	sandbox_context context;
 
 	aegis::channel* c = bot->core.find_channel(channel_id);
 	if (!c) {
 		log->error("JS::run() Can't find channel {}", channel_id);
 		return false;
 	}
-	current_guild = &c->get_guild();
-
-	/* Check if a user has a current vote in the system that is valid for the past day. If they do, boost their quotas for cpu time and ram usage. */
-	db::resultset vrs = db::query("SELECT * FROM `infobot_votes` WHERE vote_time > now() - INTERVAL 1 DAY AND snowflake_id = '?'", {std::to_string(current_guild->get_owner())});
-	if (vrs.size() > 0) {
+	context.channel_id = channel_id;
+	context.guild = &c->get_guild();
+	context.guild_id = context.guild->get_id().get();
+	context.bot_id = bot->getID();
+	context.message_total = 0;
+	context.kv = &kv;
+	context.bindings = bindings;
+	context.binding_count = sizeof(bindings) / sizeof(bindings[0]);
+
+	/* Check if a user has a current vote in the system that is valid for the past day. If they do, boost their quotas for cpu time and ram usage.
+	 * The voter index answers this from memory, the database is only asked if the index isn't being kept up to date.
+	 */
+	bool voted;
+	if (bot->voters.Fresh()) {
+		voted = bot->voters.HasVoted(context.guild->get_owner());
+	} else {
+		db::resultset vrs = db::query("SELECT * FROM `infobot_votes` WHERE vote_time > now() - INTERVAL 1 DAY AND snowflake_id = '?'", {std::to_string(context.guild->get_owner())});
+		voted = (vrs.size() > 0);
+	}
+	if (voted) {
 		/* User has voted, increase their allowances */
 		timeout = timeout_voted;
 		max_allocated = max_allocated_voted;
@@ -597,290 +886,201 @@ bool JS::run(int64_t channel_id, const std::unordered_map<std::string, json> &va
 		max_allocated = max_allocated_unvoted;
 	}
 
-	auto iter = code.find(channel_id);
-	duk_context* ctx;
-	program v;
-
-	c_apis_suck = log;
-	botref = bot;
-
-	if (iter == code.end() || settings::getJSConfig(channel_id, "dirty") == "1") {
-
-		log->info("create new context for channel {} due to reload request", channel_id);
-		std::string source = settings::getJSConfig(channel_id, "script");
-		std::string name = std::to_string(channel_id) + ".js";
-		v.name = name;
-		v.source = source;
-
-		code[channel_id] = v;
-
-		settings::setJSConfig(channel_id, "dirty", "0");
-
-	} else {
-		v = code[channel_id];
-	}
-
-	current_context = channel_id;
-	total_allocated[channel_id] = 0;
-	message_total = 0;
-
-	auto t_start = std::chrono::high_resolution_clock::now();	
-	ctx = duk_create_heap(sandbox_alloc, sandbox_realloc, sandbox_free, NULL, sandbox_fatal);
-
-	duk_push_global_object(ctx);
-	define_string(ctx, "CHANNEL_ID", std::to_string(channel_id));
-	define_string(ctx, "GUILD_ID", std::to_string(current_guild->get_id()));
-	define_string(ctx, "BOT_ID", std::to_string(bot->getID()));
-	define_func(ctx, "debuglog", js_print, DUK_VARARGS);
-	define_func(ctx, "find_user", js_find_user, 1);
-	define_func(ctx, "find_channel", js_find_channel, 1);
-	define_func(ctx, "create_message", js_create_message, DUK_VARARGS);
-	define_func(ctx, "create_embed", js_create_embed, 2);
-	define_func(ctx, "find_username", js_find_username, 1);
-	define_func(ctx, "find_channelname", js_find_channelname, 1);
-	define_func(ctx, "save", js_save, 2);
-	define_func(ctx, "load", js_load, 1);
-	define_func(ctx, "delete", js_delete, 1);
-	define_func(ctx, "get", js_get, 2);
-	define_func(ctx, "post", js_post, 3);
-	define_func(ctx, "exit", js_exit, 1);
-	define_func(ctx, "add_reaction", js_add_reaction, 3);
-	define_func(ctx, "delete_reaction", js_delete_reaction, 3);
-	if (!callback_content.empty()) {
-		define_string(ctx, "WCB_CONTENT", callback_content);
-	}
-	duk_pop(ctx);
-
-	duk_push_string(ctx, v.name.c_str());
-	std::string source;
-	for (auto i = vars.begin(); i != vars.end(); ++i) {
-		source += i->first + "=" + i->second.dump() + ";";
-	}
-
-	if (!callback_fn.empty()) {
-		source += ";" + callback_fn + "(WCB_CONTENT);exit(0);" + v.source;
-	} else {
-		source += ";" + v.source;
+	std::shared_ptr<program> v;
+	{
+		std::lock_guard<std::mutex> code_lock(code_mutex);
+		auto iter = code.find(channel_id);
+		if (iter == code.end()) {
+			/* Script was removed while this run was queued */
+			return false;
+		}
+		v = iter->second;
 	}
 
-	if (duk_pcompile_string_filename(ctx, 0, source.c_str()) != 0) {
-		lasterror = duk_safe_to_string(ctx, -1);
-		log->error("couldnt compile: {}", lasterror);
-		settings::setJSConfig(channel_id, "last_error", CleanErrorMessage(lasterror));
-		auto t_end = std::chrono::high_resolution_clock::now();
-		double compile_time_ms = std::chrono::duration<double, std::milli>(t_end-t_start).count();
-		settings::setJSConfig(channel_id, "last_compile_ms", std::to_string(compile_time_ms));
-		duk_destroy_heap(ctx);
+	sandbox_heap* heap = heaps.Acquire(max_allocated);
+	if (!heap) {
+		log->error("JS::run() Can't create a heap for channel {}", channel_id);
 		return false;
 	}
-
-	auto t_end = std::chrono::high_resolution_clock::now();
-	double compile_time_ms = std::chrono::duration<double, std::milli>(t_end-t_start).count();
-	settings::setJSConfig(channel_id, "last_compile_ms", std::to_string(compile_time_ms));
-
-	if (!duk_is_function(ctx, -1)) {
-		lasterror = "Top of stack is not a function";
-		log->error("JS error: {}", lasterror);
-		settings::setJSConfig(channel_id, "last_error", CleanErrorMessage(lasterror));
-		duk_destroy_heap(ctx);
-		return false;
+	heap->context = &context;
+	heap->timer.timeout = timeout;
+
+	js_run stats = {};
+	bool rv = sandbox_run(heap, *v, vars, callback_fn, callback_content, stats);
+	stats.error = CleanErrorMessage(stats.error);
+	telemetry.Record(channel_id, stats);
+	heap->context = nullptr;
+	heaps.Release(heap);
+
+	if (replied) {
+		*replied = context.message_total > 0;
 	}
 
-	interrupt = 0;
-	ret = DUK_EXEC_SUCCESS;
-	bool exited = false;
-	try {
-		gettimeofday(&t_script_start, nullptr);
-		ret = duk_pcall(ctx, 0);
-	}
-	catch (const ExitException &e) {
-		/* Graceful exit from javascript via an exception for the exit() function */
-		ret = DUK_EXEC_SUCCESS;
-		exited = true;
-	}
-	double exec_time_ms = (double)((t_script_now.tv_sec - t_script_start.tv_sec) * 1000000 + t_script_now.tv_usec - t_script_start.tv_usec) / 1000;
-	settings::setJSConfig(channel_id, "last_exec_ms", std::to_string(exec_time_ms));
-	settings::setJSConfig(channel_id, "last_memory_max", std::to_string(total_allocated[channel_id]));
-
-	if (ret != DUK_EXEC_SUCCESS) {
-		if (duk_is_error(ctx, -1)) {
-			duk_get_prop_string(ctx, -1, "stack");
-			lasterror = duk_safe_to_string(ctx, -1);
-			duk_pop(ctx);
-		} else {
-			lasterror = duk_safe_to_string(ctx, -1);
-		}
-		log->error("JS error: {}", lasterror);
-		settings::setJSConfig(channel_id, "last_error", CleanErrorMessage(lasterror));
-		duk_destroy_heap(ctx);
-		return false;
-	} else {
-		settings::setJSConfig(channel_id, "last_error", "");
-	}
-	if (!exited) {
-		duk_pop(ctx);
-	}
-	duk_destroy_heap(ctx);
-	return true;
+	bot->counters.Set("js_heaps_created", heaps.Created());
+	bot->counters.Set("js_heaps_reused", heaps.Reused());
+	return rv;
 }
 
-void sandbox_fatal(void *udata, const char *msg) {
-	// Yeah, according to the docs a fatal can never return. Technically, it doesnt.
-	// At this point we should probably destroy the duk context as bad.
-	std::string error = msg;
-	total_allocated[current_context] = 0;
-	throw std::runtime_error("JS error: " + error);
+JSModule::JSModule(Bot* instigator, ModuleLoader* ml) : Module(instigator, ml)
+{
+	ml->Attach({ I_OnMessage, I_OnMessageUpdate, I_OnMessageReactionAdd, I_OnMessageReactionRemove, I_OnGuildMemberAdd }, this);
+	js = new JS(bot->core.log, bot);
 }
 
-void sandbox_free(void *udata, void *ptr) {
-	alloc_hdr *hdr;
-
-	if (!ptr) {
-		return;
-	}
-	hdr = (alloc_hdr *) (((char *) ptr) - sizeof(alloc_hdr));
-	auto iter = total_allocated.find(current_context);
-	iter->second -= hdr->u.sz;
-	free((void *) hdr);
+JSModule::~JSModule()
+{
+	delete js;
 }
 
-void *sandbox_alloc(void *udata, duk_size_t size) {
-	alloc_hdr *hdr;
-
-	if (size == 0) {
-		return NULL;
-	}
-
-	auto iter = total_allocated.find(current_context);
+std::string JSModule::GetVersion()
+{
+	/* NOTE: This version string below is modified by a pre-commit hook on the git repository */
+	std::string version = "$ModVer 39$";
+	return "1.0." + version.substr(8,version.length() - 9);
+}
 
-	if (iter->second + size > max_allocated) {
-		c_apis_suck->error("Sandbox maximum allocation size reached, {} requested in sandbox_alloc", (long) size);
-		return NULL;
-	}
+std::string JSModule::GetDescription()
+{
+	return "JavaScript Per-Channel Custom Events";
+}
 
-	hdr = (alloc_hdr *) malloc(size + sizeof(alloc_hdr));
-	if (!hdr) {
-		return NULL;
+/**
+ * The channel and guild variables every event gives the script
+ */
+void JSModule::ChannelVars(std::unordered_map<std::string, json> &jsonstore, aegis::channel* c, js_event event)
+{
+	jsonstore["EVENT"] = event_name(event);
+	json chan;
+	chan["name"] = c->get_name();
+	chan["nsfw"] = c->nsfw();
+	chan["dm"] = c->is_dm();
+	chan["id"] = std::to_string(c->get_id());
+	chan["guild_id"] = std::to_string(c->get_guild_id());
+	jsonstore["channel"] = chan;
+	aegis::guild* g = bot->core.find_guild(c->get_guild_id());
+	if (g) {
+		json guild;
+		guild["name"] = g->get_name();
+		guild["owner"] = std::to_string(g->get_owner());
+		guild["id"] = std::to_string(g->get_id());
+		guild["region"] = g->get_region();
+		guild["member_count"] = g->get_member_count();
+		jsonstore["guild"] = guild;
 	}
-	hdr->u.sz = size;
-	iter->second += size;
-	return (void *) (hdr + 1);
 }
 
-static void *sandbox_realloc(void *udata, void *ptr, duk_size_t size) {
-	alloc_hdr *hdr;
-	size_t old_size;
-	void *t;
-
-	auto iter = total_allocated.find(current_context);
-
-	/* Handle the ptr-NULL vs. size-zero cases explicitly to minimize
-	 * platform assumptions.  You can get away with much less in specific
-	 * well-behaving environments.
-	 */
-
-	if (ptr) {
-		hdr = (alloc_hdr *) (((char *) ptr) - sizeof(alloc_hdr));
-		old_size = hdr->u.sz;
-
-		if (size == 0) {
-			iter->second -= old_size;
-			free((void *) hdr);
-			return NULL;
-		} else {
-			if (iter->second - old_size + size > max_allocated) {
-				c_apis_suck->error("Sandbox maximum allocation size reached, {} requested in sandbox_realloc", (long) size);
-				return NULL;
-			}
-
-			t = realloc((void *) hdr, size + sizeof(alloc_hdr));
-			if (!t) {
-				return NULL;
-			}
-			hdr = (alloc_hdr *) t;
-			iter->second -= old_size;
-			iter->second += size;
-			hdr->u.sz = size;
-			return (void *) (hdr + 1);
-		}
-	} else {
-		if (size == 0) {
-			return NULL;
-		} else {
-			if (iter->second + size > max_allocated) {
-				c_apis_suck->error("Sandbox maximum allocation size reached, {} requested in sandbox_realloc", (long) size);
-				return NULL;
-			}
+/**
+ * The variables for a new or edited message
+ */
+void JSModule::MessageVars(std::unordered_map<std::string, json> &jsonstore, aegis::channel* c, js_event event, const aegis::gateway::objects::message &msg, const std::vector<std::string> &stringmentions)
+{
+	ChannelVars(jsonstore, c, event);
+	aegis::gateway::objects::to_json(jsonstore["message"], msg);
+	aegis::gateway::objects::to_json(jsonstore["author"], msg.author);
+	jsonstore["message"]["id"] = std::to_string(msg.get_id());
+	jsonstore["message"]["nonce"] = std::to_string(msg.nonce);
+	jsonstore["mentions"] = stringmentions;
+	jsonstore["author"]["id"] = std::to_string(msg.author.id);
+	jsonstore["author"]["guild_id"] = jsonstore["channel"]["guild_id"];
+}
 
-			hdr = (alloc_hdr *) malloc(size + sizeof(alloc_hdr));
-			if (!hdr) {
-				return NULL;
-			}
-			hdr->u.sz = size;
-			iter->second += size;
-			return (void *) (hdr + 1);
-		}
+bool JSModule::OnMessage(const modevent::message_create &message, const std::string& clean_message, bool mentioned, const std::vector<std::string> &stringmentions)
+{
+	aegis::channel* c = &message.channel;
+	if (js->Wants(c->get_id().get(), je_message, message.msg.get_content(), bot->core.find_guild(message.msg.get_guild_id()), message.msg.author.id.get())) {
+		std::unordered_map<std::string, json> jsonstore;
+		MessageVars(jsonstore, c, je_message, message.msg, stringmentions);
+		/* Wait for this script, but not for any other channel's */
+		return !js->Queue(c->get_id().get(), jsonstore).get();
 	}
+	return true;
 }
 
-JSModule::JSModule(Bot* instigator, ModuleLoader* ml) : Module(instigator, ml)
+/**
+ * Edits are ignored from bots and the bot itself, as new messages are
+ */
+bool JSModule::OnMessageUpdate(const modevent::message_update &obj)
 {
-	ml->Attach({ I_OnMessage }, this);
-	js = new JS(bot->core.log, bot);
+	aegis::channel* c = &obj.channel;
+	/* Embed unfurls arrive as updates with no author or content, and aren't edits */
+	if (obj.msg.author.id.get() == 0 || obj.msg.get_content().empty()) {
+		return true;
+	}
+	if (obj.msg.author.id == bot->user.id || obj.msg.author.is_bot()) {
+		return true;
+	}
+	if (js->Wants(c->get_id().get(), je_message_update, obj.msg.get_content(), bot->core.find_guild(obj.msg.get_guild_id()), obj.msg.author.id.get())) {
+		std::unordered_map<std::string, json> jsonstore;
+		std::vector<std::string> stringmentions;
+		for (auto m = obj.msg.mentions.begin(); m != obj.msg.mentions.end(); ++m) {
+			stringmentions.push_back(std::to_string(m->get()));
+		}
+		MessageVars(jsonstore, c, je_message_update, obj.msg, stringmentions);
+		js->Queue(c->get_id().get(), jsonstore);
+	}
+	return true;
 }
 
-JSModule::~JSModule()
+/**
+ * Reactions made by the bot itself are ignored, so a script which reacts to reactions can't
+ * trigger itself forever.
+ */
+void JSModule::Reaction(js_event event, int64_t user_id, int64_t channel_id, int64_t message_id, int64_t guild_id, const aegis::gateway::objects::emoji &emoji)
 {
-	delete js;
+	if (user_id == bot->getID()) {
+		return;
+	}
+	aegis::channel* c = bot->core.find_channel(channel_id);
+	if (c && js->Wants(channel_id, event, "", bot->core.find_guild(guild_id), user_id)) {
+		std::unordered_map<std::string, json> jsonstore;
+		ChannelVars(jsonstore, c, event);
+		jsonstore["reaction"] = {
+			{ "user_id", std::to_string(user_id) },
+			{ "message_id", std::to_string(message_id) },
+			{ "channel_id", std::to_string(channel_id) },
+			{ "guild_id", std::to_string(guild_id) },
+			{ "emoji", { { "id", std::to_string(emoji.id.get()) }, { "name", emoji.name } } }
+		};
+		js->Queue(channel_id, jsonstore);
+	}
 }
 
-std::string JSModule::GetVersion()
+bool JSModule::OnMessageReactionAdd(const modevent::message_reaction_add &obj)
 {
-	/* NOTE: This version string below is modified by a pre-commit hook on the git repository */
-	std::string version = "$ModVer 16$";
-	return "1.0." + version.substr(8,version.length() - 9);
+	Reaction(je_reaction_add, obj.user_id.get(), obj.channel_id.get(), obj.message_id.get(), obj.guild_id.get(), obj.emoji);
+	return true;
 }
 
-std::string JSModule::GetDescription()
+bool JSModule::OnMessageReactionRemove(const modevent::message_reaction_remove &obj)
 {
-	return "JavaScript Per-Channel Custom Events";
+	Reaction(je_reaction_remove, obj.user_id.get(), obj.channel_id.get(), obj.message_id.get(), obj.guild_id.get(), obj.emoji);
+	return true;
 }
 
-bool JSModule::OnMessage(const modevent::message_create &message, const std::string& clean_message, bool mentioned, const std::vector<std::string> &stringmentions)
+/**
+ * A join has no channel of its own, so it goes to every channel of the guild whose script asked for member_add
+ */
+bool JSModule::OnGuildMemberAdd(const modevent::guild_member_add &gma)
 {
-	std::unordered_map<std::string, json> jsonstore;
-	modevent::message_create msg = message;
-
-	if (js->channelHasJS(msg.channel.get_id().get())) {
-
-		json chan;
-		const aegis::channel& c = message.channel;
-		chan["name"] = c.get_name();
-		chan["nsfw"] = c.nsfw();
-		chan["dm"] = c.is_dm();
-		json guild;
-		aegis::guild* g = bot->core.find_guild(message.msg.get_guild_id());
-		if (g) {
-			guild["name"] = g->get_name();
-			guild["owner"] = std::to_string(g->get_owner());
-			guild["id"] = std::to_string(message.msg.get_guild_id());
-			guild["region"] = g->get_region();
-			guild["member_count"] = g->get_member_count();
-			jsonstore["guild"] = guild;
+	aegis::guild* g = bot->core.find_guild(gma.member.guild_id);
+	if (!g) {
+		return true;
+	}
+	json member;
+	aegis::gateway::objects::to_json(member, gma.member._user);
+	member["id"] = std::to_string(gma.member._user.id);
+	member["guild_id"] = std::to_string(gma.member.guild_id.get());
+	member["roles"] = json::array();
+	for (auto r = gma.member.roles.begin(); r != gma.member.roles.end(); ++r) {
+		member["roles"].push_back(std::to_string(r->get()));
+	}
+	for (auto i = g->get_channels().begin(); i != g->get_channels().end(); ++i) {
+		if (js->Wants(i->first, je_member_add, "", g, gma.member._user.id.get())) {
+			std::unordered_map<std::string, json> jsonstore;
+			ChannelVars(jsonstore, i->second, je_member_add);
+			jsonstore["member"] = member;
+			js->Queue(i->first, jsonstore);
 		}
-		jsonstore["channel"] = chan;
-		aegis::gateway::objects::to_json(jsonstore["message"], message.msg);
-		aegis::gateway::objects::to_json(jsonstore["author"], message.msg.author);
-		jsonstore["message"]["id"] = std::to_string(message.msg.get_id());
-		jsonstore["message"]["nonce"] = std::to_string(message.msg.nonce);
-		jsonstore["mentions"] = stringmentions;
-		jsonstore["channel"]["id"] = std::to_string(c.get_id());
-		jsonstore["channel"]["guild_id"] = std::to_string(message.msg.get_guild_id().get());
-		jsonstore["author"]["id"] = std::to_string(message.msg.author.id);
-		jsonstore["author"]["guild_id"] = jsonstore["channel"]["guild_id"];
-
-		js->run(c.get_id().get(), jsonstore);
-		return !js->hasReplied();
 	}
 	return true;
 }
@@ -20,41 +20,98 @@
 
 #pragma once
 #include <unordered_map>
+#include <unordered_set>
 #include <string>
 #include <vector>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <future>
 #include "duktape.h"
+#include "heappool.h"
+#include "workerpool.h"
+#include "telemetry.h"
+#include "kvcache.h"
+#include "httpclient.h"
+#include "sandbox.h"
 #include <spdlog/spdlog.h>
 #include <aegis.hpp>
 #include <sporks/modules.h>
 
 using json = nlohmann::json; 
 
+/* How often to check for changed scripts, in seconds */
+const int js_script_poll_seconds = 2;
+
+struct program;
+
+/* Events a channel's script can ask to be run for, as a bit mask */
+enum js_event {
+	je_message = 1,
+	je_message_update = 2,
+	je_reaction_add = 4,
+	je_reaction_remove = 8,
+	je_member_add = 16
+};
+
 class JS {
-	std::string lasterror;
 	std::shared_ptr<spdlog::logger>& log;
 	class Bot* bot;
-	std::thread* web_request_watcher;
-	std::mutex jsmutex;
-	bool terminate;
+	/* Makes the get() and post() web requests */
+	HTTPClient* http;
+	/* Guilds with a web request in progress */
+	std::unordered_set<int64_t> web_guilds;
+	std::mutex web_mutex;
+	std::thread* script_watcher;
+	/* Row count and newest creation date of the JS channels when they were last loaded */
+	std::string channel_summary;
+	/* Set when unloading. Checked under web_mutex before starting a web request or queueing its callback */
+	std::atomic<bool> terminate;
+	/* Warm Duktape heaps, reused between runs */
+	HeapPool heaps;
+	/* Threads which run the scripts, one channel per worker */
+	WorkerPool* workers;
+	/* Per-channel run statistics, written to the database in batches */
+	JSTelemetry telemetry;
+	/* Write-back cache for the save(), load() and delete() bindings */
+	KVCache kv;
 public:
 	JS(std::shared_ptr<spdlog::logger>& logger, class Bot* bot);
 	~JS();
-	bool run(int64_t channel_id, const std::unordered_map<std::string, json> &vars, const std::string &callback_fn = "", const std::string &callback_content = "");
-	void WebRequestWatch();
-	bool hasReplied();
+	/* Run a script on the calling thread. If replied is given, it is set to whether the script sent any messages. */
+	bool run(int64_t channel_id, const std::unordered_map<std::string, json> &vars, const std::string &callback_fn = "", const std::string &callback_content = "", bool* replied = nullptr);
+	/* Run a script on the channel's worker thread. The future is true if the script sent any messages. */
+	std::future<bool> Queue(int64_t channel_id, const std::unordered_map<std::string, json> &vars, const std::string &callback_fn = "", const std::string &callback_content = "");
+	/* Start a web request on behalf of a script, calling back into the script when it completes */
+	bool WebRequest(int64_t channel_id, int64_t guild_id, const std::string &method, const std::string &url, const std::string &callback, const std::string &postdata);
+	/* Load all channels' scripts into memory, compiling any new or changed ones */
+	void LoadScripts();
+	/* Compile a program's main script ahead of its first run. Returns false if it doesn't compile. */
+	bool Precompile(int64_t channel_id, program &p);
+	/* Poll for changed, added and removed scripts */
+	void ScriptWatch();
 	bool channelHasJS(int64_t channel_id);
+	/* True if the channel has a script which wants this event and the event passes its filters */
+	bool Wants(int64_t channel_id, js_event event, const std::string &content, aegis::guild* guild, int64_t user_id);
 };
 
 class JSModule : public Module
 {
 	JS* js;
+	/* Build the variables a script is given for an event */
+	void ChannelVars(std::unordered_map<std::string, json> &jsonstore, aegis::channel* c, js_event event);
+	void MessageVars(std::unordered_map<std::string, json> &jsonstore, aegis::channel* c, js_event event, const aegis::gateway::objects::message &msg, const std::vector<std::string> &stringmentions);
+	/* Run the channel's script for a reaction being added or removed */
+	void Reaction(js_event event, int64_t user_id, int64_t channel_id, int64_t message_id, int64_t guild_id, const aegis::gateway::objects::emoji &emoji);
 public:
         JSModule(Bot* instigator, ModuleLoader* ml);
         virtual ~JSModule();
         virtual std::string GetVersion();
         virtual std::string GetDescription();
         virtual bool OnMessage(const modevent::message_create &message, const std::string& clean_message, bool mentioned, const std::vector<std::string> &stringmentions);
+        virtual bool OnMessageUpdate(const modevent::message_update &obj);
+        virtual bool OnMessageReactionAdd(const modevent::message_reaction_add &obj);
+        virtual bool OnMessageReactionRemove(const modevent::message_reaction_remove &obj);
+        virtual bool OnGuildMemberAdd(const modevent::guild_member_add &gma);
 };
 
@@ -0,0 +1,274 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <sporks/database.h>
+#include "kvcache.h"
+
+KVCache::KVCache() : dirty_bytes(0), terminate(false), flush_now(false)
+{
+	flusher = new std::thread(&KVCache::FlushThread, this);
+}
+
+KVCache::~KVCache()
+{
+	terminate = true;
+	flusher->join();
+	delete flusher;
+	Flush();
+}
+
+void KVCache::FlushThread()
+{
+	int elapsed = 0;
+	while (!terminate) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(250));
+		if (++elapsed >= kv_flush_seconds * 4 || flush_now) {
+			flush_now = false;
+			Flush();
+			elapsed = 0;
+		}
+	}
+}
+
+bool KVCache::Get(int64_t guild_id, const std::string &key, std::string &value)
+{
+	{
+		std::lock_guard<std::mutex> kv_lock(kv_mutex);
+		auto g = guilds.find(guild_id);
+		if (g != guilds.end()) {
+			g->second.last_used = time(NULL);
+			auto e = g->second.keys.find(key);
+			if (e != g->second.keys.end()) {
+				value = e->second.value;
+				return e->second.exists;
+			}
+		}
+	}
+
+	/* Not cached, read through. The lock isn't held during the query. */
+	db::resultset rs;
+	if (!db::query("SELECT value FROM infobot_javascript_kv WHERE guild_id = ? AND keyname = '?'", {guild_id, key}, rs)) {
+		return false;
+	}
+	bool exists = (rs.size() == 1 && rs[0].find("value") != rs[0].end());
+
+	std::lock_guard<std::mutex> kv_lock(kv_mutex);
+	guild_kv &g = guilds[guild_id];
+	g.last_used = time(NULL);
+	auto e = g.keys.find(key);
+	if (e != g.keys.end()) {
+		/* Changed by another run while we were querying, which is newer than what we read */
+		value = e->second.value;
+		return e->second.exists;
+	}
+	entry &n = g.keys[key];
+	n.exists = exists;
+	n.dirty = false;
+	n.version = 0;
+	if (exists) {
+		n.value = rs[0].find("value")->second;
+	}
+	g.bytes += key.length() + n.value.length();
+	value = n.value;
+	return exists;
+}
+
+void KVCache::ChangeLocked(int64_t guild_id, const std::string &key, const std::string &value, bool exists)
+{
+	guild_kv &g = guilds[guild_id];
+	g.last_used = time(NULL);
+	bool cached = (g.keys.find(key) != g.keys.end());
+	entry &e = g.keys[key];
+	size_t old_bytes = key.length() + e.value.length();
+	if (cached) {
+		g.bytes -= old_bytes;
+	}
+	if (e.dirty) {
+		g.dirty_bytes -= old_bytes;
+		dirty_bytes -= old_bytes;
+	}
+	e.value = value;
+	e.exists = exists;
+	e.dirty = true;
+	e.version++;
+	size_t new_bytes = key.length() + value.length();
+	g.bytes += new_bytes;
+	g.dirty_bytes += new_bytes;
+	dirty_bytes += new_bytes;
+
+	if (g.bytes > kv_guild_quota || dirty_bytes > kv_dirty_max) {
+		flush_now = true;
+	}
+}
+
+void KVCache::Set(int64_t guild_id, const std::string &key, const std::string &value)
+{
+	std::lock_guard<std::mutex> kv_lock(kv_mutex);
+	ChangeLocked(guild_id, key, value, true);
+}
+
+void KVCache::Delete(int64_t guild_id, const std::string &key)
+{
+	std::lock_guard<std::mutex> kv_lock(kv_mutex);
+	ChangeLocked(guild_id, key, "", false);
+}
+
+bool KVCache::FlushGuild(int64_t guild_id)
+{
+	/* Snapshot of the dirty keys and the version written for each */
+	std::vector<std::pair<std::string, uint64_t>> upserts, deletes;
+	db::paramlist upsert_params;
+	{
+		std::lock_guard<std::mutex> kv_lock(kv_mutex);
+		auto g = guilds.find(guild_id);
+		if (g == guilds.end() || g->second.dirty_bytes == 0) {
+			return true;
+		}
+		for (auto e = g->second.keys.begin(); e != g->second.keys.end(); ++e) {
+			if (e->second.dirty) {
+				if (e->second.exists) {
+					upserts.emplace_back(e->first, e->second.version);
+					upsert_params.emplace_back(guild_id);
+					upsert_params.emplace_back(e->first);
+					upsert_params.emplace_back(e->second.value);
+				} else {
+					deletes.emplace_back(e->first, e->second.version);
+				}
+			}
+		}
+	}
+
+	/* What happened to each snapshotted key. Keys which were never sent stay dirty. */
+	enum outcome : char { unsent, written, rejected };
+	std::vector<outcome> upserted(upserts.size(), unsent), deleted(deletes.size(), unsent);
+
+	/* Deletes go first, as they can only make room under the guild's quota. A transient error,
+	 * e.g. a lost connection, stops the flush and leaves everything not yet written for next time.
+	 * A batch the server rejects, e.g. by the check_max trigger, only affects that batch.
+	 */
+	bool transient = false;
+	for (size_t start = 0; start < deletes.size() && !transient; start += kv_batch) {
+		size_t end = std::min(deletes.size(), start + kv_batch);
+		std::string keys;
+		db::paramlist params = { guild_id };
+		for (size_t i = start; i < end; ++i) {
+			keys += (i == start ? "'?'" : ",'?'");
+			params.emplace_back(deletes[i].first);
+		}
+		bool ok = db::execute("DELETE FROM infobot_javascript_kv WHERE guild_id = ? AND keyname IN (" + keys + ")", params);
+		transient = !ok && db::transient_error();
+		if (!transient) {
+			std::fill(deleted.begin() + start, deleted.begin() + end, ok ? written : rejected);
+		}
+	}
+	for (size_t start = 0; start < upserts.size() && !transient; start += kv_batch) {
+		size_t end = std::min(upserts.size(), start + kv_batch);
+		std::string values;
+		for (size_t i = start; i < end; ++i) {
+			values += (i == start ? "(?,'?','?')" : ",(?,'?','?')");
+		}
+		db::paramlist params(upsert_params.begin() + start * 3, upsert_params.begin() + end * 3);
+		bool ok = db::execute("INSERT INTO infobot_javascript_kv (guild_id, keyname, value) VALUES " + values + " ON DUPLICATE KEY UPDATE value = VALUES(value)", params);
+		transient = !ok && db::transient_error();
+		if (!transient) {
+			std::fill(upserted.begin() + start, upserted.begin() + end, ok ? written : rejected);
+		}
+	}
+
+	bool all_written = std::all_of(upserted.begin(), upserted.end(), [](outcome o) { return o == written; }) &&
+		std::all_of(deleted.begin(), deleted.end(), [](outcome o) { return o == written; });
+
+	std::lock_guard<std::mutex> kv_lock(kv_mutex);
+	auto g = guilds.find(guild_id);
+	if (g == guilds.end()) {
+		return all_written;
+	}
+	for (auto w : { std::make_pair(&upserts, &upserted), std::make_pair(&deletes, &deleted) }) {
+		for (size_t i = 0; i < w.first->size(); ++i) {
+			const std::pair<std::string, uint64_t> &k = (*w.first)[i];
+			outcome o = (*w.second)[i];
+			auto e = g->second.keys.find(k.first);
+			if (o == unsent || e == g->second.keys.end() || e->second.version != k.second) {
+				/* Not sent, or changed again since the snapshot: still to be written */
+				continue;
+			}
+			size_t bytes = k.first.length() + e->second.value.length();
+			g->second.dirty_bytes -= bytes;
+			dirty_bytes -= bytes;
+			if (o == written) {
+				e->second.dirty = false;
+			} else {
+				/* Rejected, forget it so the next read sees what the database really holds */
+				g->second.bytes -= bytes;
+				g->second.keys.erase(e);
+			}
+		}
+	}
+	return all_written;
+}
+
+void KVCache::Flush()
+{
+	std::vector<int64_t> ids;
+	{
+		std::lock_guard<std::mutex> kv_lock(kv_mutex);
+		for (auto g = guilds.begin(); g != guilds.end(); ++g) {
+			ids.push_back(g->first);
+		}
+	}
+
+	for (auto id = ids.begin(); id != ids.end(); ++id) {
+		FlushGuild(*id);
+	}
+
+	/* Drop guilds which have gone idle, and unchanged keys of guilds over their quota */
+	time_t now = time(NULL);
+	std::lock_guard<std::mutex> kv_lock(kv_mutex);
+	for (auto g = guilds.begin(); g != guilds.end();) {
+		if (g->second.dirty_bytes == 0 && now - g->second.last_used > kv_idle_seconds) {
+			g = guilds.erase(g);
+			continue;
+		}
+		if (g->second.bytes > kv_guild_quota) {
+			for (auto e = g->second.keys.begin(); e != g->second.keys.end();) {
+				if (!e->second.dirty) {
+					g->second.bytes -= e->first.length() + e->second.value.length();
+					e = g->second.keys.erase(e);
+				} else {
+					++e;
+				}
+			}
+		}
+		++g;
+	}
+}
+
+size_t KVCache::Size()
+{
+	std::lock_guard<std::mutex> kv_lock(kv_mutex);
+	size_t size = 0;
+	for (auto g = guilds.begin(); g != guilds.end(); ++g) {
+		size += g->second.keys.size();
+	}
+	return size;
+}
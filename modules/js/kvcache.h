@@ -0,0 +1,117 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <unordered_map>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <ctime>
+#include <cstdint>
+
+/* How often dirty keys are written to the database, in seconds */
+const int kv_flush_seconds = 5;
+
+/* Bytes of keys and values a guild may hold in the cache. Beyond this its changes are written out and its unchanged keys dropped. */
+const size_t kv_guild_quota = 256 * 1024;
+
+/* Total bytes of unwritten changes across all guilds which triggers an early write */
+const size_t kv_dirty_max = 4 * 1024 * 1024;
+
+/* Guilds whose keys haven't been used for this many seconds are dropped from the cache once written */
+const time_t kv_idle_seconds = 600;
+
+/* Maximum keys per INSERT or DELETE statement */
+const size_t kv_batch = 500;
+
+/**
+ * A write-back cache in front of infobot_javascript_kv, used by the save(), load() and
+ * delete() bindings.
+ *
+ * A key is read from the database the first time it is asked for, and the answer (including
+ * "no such key") is then kept. Writes and deletes only change the cache, and are written to
+ * the database every few seconds in multi-row statements, so a script which updates a
+ * counter on every message costs no queries at all most of the time. The cache is always
+ * consulted first, so a script sees its own writes immediately.
+ *
+ * Each guild's writes are sent in their own statements, as the table's triggers may reject a
+ * guild's insert (e.g. too many keys). When that happens the keys in the rejected statement are
+ * dropped from the cache so that the next read sees what the database really holds. If a write
+ * fails for a transient reason, such as a lost connection, nothing more is sent and every
+ * change not yet written stays dirty for the next flush.
+ */
+class KVCache {
+
+	struct entry {
+		std::string value;
+		/* False if the key is known not to exist */
+		bool exists;
+		/* True if the cached state hasn't been written yet */
+		bool dirty;
+		/* Incremented on every change, so a write which raced with a change doesn't mark it clean */
+		uint64_t version;
+	};
+
+	struct guild_kv {
+		std::unordered_map<std::string, entry> keys;
+		size_t bytes;
+		size_t dirty_bytes;
+		time_t last_used;
+	};
+
+	std::unordered_map<int64_t, guild_kv> guilds;
+	std::mutex kv_mutex;
+	size_t dirty_bytes;
+
+	std::thread* flusher;
+	std::atomic<bool> terminate;
+	std::atomic<bool> flush_now;
+
+	/* Flusher thread body */
+	void FlushThread();
+
+	/* Write one guild's changes, returns false if any of them weren't written */
+	bool FlushGuild(int64_t guild_id);
+
+	/* Record a change to a key, caller must hold kv_mutex */
+	void ChangeLocked(int64_t guild_id, const std::string &key, const std::string &value, bool exists);
+
+public:
+	KVCache();
+
+	/* Writes all outstanding changes before returning */
+	~KVCache();
+
+	/* Look up a key, reading it from the database if it isn't cached. Returns false if there is no such key. */
+	bool Get(int64_t guild_id, const std::string &key, std::string &value);
+
+	/* Set a key's value */
+	void Set(int64_t guild_id, const std::string &key, const std::string &value);
+
+	/* Delete a key */
+	void Delete(int64_t guild_id, const std::string &key);
+
+	/* Write every guild's outstanding changes now, and drop idle guilds */
+	void Flush();
+
+	/* Number of keys cached, across all guilds */
+	size_t Size();
+};
@@ -0,0 +1,116 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <string>
+#include "marshal.h"
+
+/**
+ * Getter (magic 0) and setter (magic 1) standing in for a nested object or array of an injected
+ * variable until the script first touches it. The first read builds the value from the json it
+ * points at, the first write just takes the new value, and either way the accessor replaces
+ * itself with an ordinary data property so this only ever happens once per property.
+ */
+static duk_ret_t lazy_json(duk_context *cx)
+{
+	bool setter = duk_get_current_magic(cx);
+	duk_push_current_function(cx);
+	duk_get_prop_string(cx, -1, DUK_HIDDEN_SYMBOL("json"));
+	const json* node = (const json*)duk_get_pointer(cx, -1);
+	duk_get_prop_string(cx, -2, DUK_HIDDEN_SYMBOL("key"));
+	std::string key = duk_get_string(cx, -1);
+	duk_pop_3(cx);
+
+	duk_push_this(cx);
+	duk_push_string(cx, key.c_str());
+	if (setter) {
+		duk_dup(cx, 0);
+	} else {
+		push_json(cx, *node);
+	}
+	duk_dup(cx, -1);
+	duk_insert(cx, -4);
+	duk_def_prop(cx, -3, DUK_DEFPROP_HAVE_VALUE | DUK_DEFPROP_SET_WRITABLE | DUK_DEFPROP_SET_ENUMERABLE | DUK_DEFPROP_SET_CONFIGURABLE);
+	duk_pop(cx);
+	return 1;
+}
+
+/**
+ * Set a property of the object at obj_idx to a nested json value. Non-empty objects and arrays
+ * are given a lazy_json accessor, so e.g. message.embeds costs nothing unless it is read.
+ * The accessors point into the json, which is why it has to outlive the script.
+ */
+static void put_json_prop(duk_context *cx, duk_idx_t obj_idx, const std::string &key, const json &value)
+{
+	if (value.is_structured() && !value.empty()) {
+		duk_push_string(cx, key.c_str());
+		for (duk_int_t magic = 0; magic < 2; ++magic) {
+			duk_push_c_function(cx, lazy_json, 1);
+			duk_set_magic(cx, -1, magic);
+			duk_push_pointer(cx, (void*)&value);
+			duk_put_prop_string(cx, -2, DUK_HIDDEN_SYMBOL("json"));
+			duk_push_string(cx, key.c_str());
+			duk_put_prop_string(cx, -2, DUK_HIDDEN_SYMBOL("key"));
+		}
+		duk_def_prop(cx, obj_idx, DUK_DEFPROP_HAVE_GETTER | DUK_DEFPROP_HAVE_SETTER | DUK_DEFPROP_SET_ENUMERABLE | DUK_DEFPROP_SET_CONFIGURABLE);
+	} else {
+		push_json(cx, value);
+		duk_put_prop_lstring(cx, obj_idx, key.data(), key.length());
+	}
+}
+
+/**
+ * Only the top level of an object or array is built here, anything nested below it is lazy.
+ */
+void push_json(duk_context *cx, const json &value)
+{
+	switch (value.type()) {
+		case json::value_t::object: {
+			duk_idx_t obj_idx = duk_push_object(cx);
+			for (auto i = value.begin(); i != value.end(); ++i) {
+				put_json_prop(cx, obj_idx, i.key(), i.value());
+			}
+		}
+		break;
+		case json::value_t::array: {
+			duk_idx_t arr_idx = duk_push_array(cx);
+			duk_uarridx_t n = 0;
+			for (auto i = value.begin(); i != value.end(); ++i) {
+				put_json_prop(cx, arr_idx, std::to_string(n++), *i);
+			}
+		}
+		break;
+		case json::value_t::string: {
+			const std::string &str = value.get_ref<const std::string&>();
+			duk_push_lstring(cx, str.data(), str.length());
+		}
+		break;
+		case json::value_t::boolean:
+			duk_push_boolean(cx, value.get<bool>());
+		break;
+		case json::value_t::number_integer:
+		case json::value_t::number_unsigned:
+		case json::value_t::number_float:
+			duk_push_number(cx, value.get<double>());
+		break;
+		default:
+			duk_push_null(cx);
+		break;
+	}
+}
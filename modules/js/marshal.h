@@ -0,0 +1,33 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <nlohmann/json.hpp>
+#include "duktape.h"
+
+using json = nlohmann::json;
+
+/**
+ * Push a json value onto the duktape stack as the equivalent ECMAScript value, without
+ * serialising it to text and having duktape parse it again. Nested objects and arrays are
+ * only built when the script first reads them, so the json must stay alive, and unchanged,
+ * for as long as the script can run.
+ */
+void push_json(duk_context *cx, const json &value);
@@ -0,0 +1,158 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <algorithm>
+#include <vector>
+#include <unordered_set>
+#include "profiler.h"
+
+script_profile::script_profile() : runs(0), exec_ms(0), samples(0), allocations(0), allocated_bytes(0), memory_peak(0)
+{
+}
+
+/**
+ * Besides the hottest call stacks, each function is reported with the samples it was running
+ * in itself (self) and the samples it was anywhere on the stack (total). A recursive function
+ * is only counted once per sample.
+ */
+json script_profile::Summary() const
+{
+	std::unordered_map<std::string, std::pair<uint64_t, uint64_t>> functions;
+	for (auto & s : stacks) {
+		std::unordered_set<std::string> seen;
+		size_t start = 0;
+		while (start <= s.first.length()) {
+			size_t end = s.first.find(';', start);
+			if (end == std::string::npos) {
+				end = s.first.length();
+			}
+			std::string frame = s.first.substr(start, end - start);
+			if (seen.insert(frame).second) {
+				functions[frame].second += s.second;
+			}
+			if (end == s.first.length()) {
+				functions[frame].first += s.second;
+			}
+			start = end + 1;
+		}
+	}
+
+	std::vector<std::pair<std::string, std::pair<uint64_t, uint64_t>>> by_self(functions.begin(), functions.end());
+	std::sort(by_self.begin(), by_self.end(), [](const auto &a, const auto &b) { return a.second.first > b.second.first; });
+	std::vector<std::pair<std::string, uint64_t>> by_stack(stacks.begin(), stacks.end());
+	std::sort(by_stack.begin(), by_stack.end(), [](const auto &a, const auto &b) { return a.second > b.second; });
+	std::vector<std::pair<std::string, binding_time>> by_time(bindings.begin(), bindings.end());
+	std::sort(by_time.begin(), by_time.end(), [](const auto &a, const auto &b) { return a.second.ms > b.second.ms; });
+
+	json j = {
+		{ "runs", runs },
+		{ "exec_ms", exec_ms },
+		{ "samples", samples },
+		{ "sample_us", profile_sample_us },
+		{ "allocations", allocations },
+		{ "allocated_bytes", allocated_bytes },
+		{ "memory_peak", memory_peak },
+		{ "functions", json::array() },
+		{ "stacks", json::array() },
+		{ "bindings", json::array() }
+	};
+	for (size_t i = 0; i < by_self.size() && i < profile_summary_top; ++i) {
+		j["functions"].push_back({ { "name", by_self[i].first }, { "self", by_self[i].second.first }, { "total", by_self[i].second.second } });
+	}
+	for (size_t i = 0; i < by_stack.size() && i < profile_summary_top; ++i) {
+		j["stacks"].push_back({ { "stack", by_stack[i].first }, { "samples", by_stack[i].second } });
+	}
+	for (auto & b : by_time) {
+		j["bindings"].push_back({ { "name", b.first }, { "calls", b.second.calls }, { "ms", b.second.ms } });
+	}
+	return j;
+}
+
+ScriptProfiler::ScriptProfiler(duk_context* run_ctx, script_profile &p) : ctx(run_ctx), profile(p)
+{
+}
+
+/**
+ * This runs inside Duktape's interrupt handler, at an instruction boundary, which is as safe a
+ * place to call into the API as Duktape's own debugger uses. It must leave the value stack as it
+ * found it and never run script code, so a function's name is only read if it is a plain value.
+ * If a coroutine is running, the stack sampled is the run's own thread, up to the resume() call.
+ */
+void ScriptProfiler::Sample()
+{
+	if (!duk_check_stack(ctx, 4)) {
+		return;
+	}
+	std::string stack;
+	for (int level = -1; level >= -profile_max_depth; --level) {
+		duk_inspect_callstack_entry(ctx, level);
+		if (!duk_is_object(ctx, -1)) {
+			duk_pop(ctx);
+			break;
+		}
+		duk_get_prop_string(ctx, -1, "lineNumber");
+		std::string line = std::to_string(duk_get_int(ctx, -1));
+		duk_pop(ctx);
+		duk_get_prop_string(ctx, -1, "function");
+		std::string name;
+		if (duk_is_object(ctx, -1)) {
+			duk_push_string(ctx, "name");
+			duk_get_prop_desc(ctx, -2, 0);
+			if (duk_is_object(ctx, -1)) {
+				duk_get_prop_string(ctx, -1, "value");
+				if (duk_is_string(ctx, -1)) {
+					name = duk_get_string(ctx, -1);
+				}
+				duk_pop(ctx);
+			}
+			duk_pop(ctx);
+		}
+		if (duk_is_c_function(ctx, -1)) {
+			/* Built-ins such as RegExp test(), and the bot's own bindings */
+			name = name.empty() ? "(native)" : name + " (native)";
+		} else {
+			name = (name.empty() ? "(anonymous)" : name) + ":" + line;
+		}
+		duk_pop_2(ctx);
+		stack = stack.empty() ? name : name + ";" + stack;
+	}
+	if (stack.empty()) {
+		return;
+	}
+	profile.samples++;
+	auto s = profile.stacks.find(stack);
+	if (s != profile.stacks.end()) {
+		s->second++;
+	} else if (profile.stacks.size() < profile_max_stacks) {
+		profile.stacks[stack] = 1;
+	} else {
+		profile.stacks["(other)"]++;
+	}
+}
+
+void ScriptProfiler::BindingCall(const char* name)
+{
+	profile.bindings[name].calls++;
+}
+
+void ScriptProfiler::BindingTime(const char* name, double ms)
+{
+	profile.bindings[name].ms += ms;
+}
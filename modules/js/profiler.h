@@ -0,0 +1,92 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <unordered_map>
+#include <string>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+#include "duktape.h"
+
+using json = nlohmann::json;
+
+/* Minimum run time between call stack samples, in microseconds. Samples are taken from the
+ * timeout check, which Duktape only makes every few hundred thousand instructions, so on a slow
+ * machine the real interval can be longer.
+ */
+const uint64_t profile_sample_us = 1000;
+
+/* Deepest call stack recorded by a sample, counted from the innermost function */
+const int profile_max_depth = 16;
+
+/* Distinct call stacks kept per channel. Further stacks are counted together as "(other)" */
+const size_t profile_max_stacks = 256;
+
+/* A sample isn't taken if the script has less than this many bytes of its quota left, as taking it allocates */
+const size_t profile_sample_headroom = 16 * 1024;
+
+/* Entries of each list kept in a profile summary */
+const size_t profile_summary_top = 20;
+
+/**
+ * Profile of the runs of one channel's script, since profiling was switched on or the script
+ * last changed. Only ever touched by the channel's worker.
+ */
+struct script_profile {
+	struct binding_time {
+		uint64_t calls;
+		double ms;
+	};
+
+	uint64_t runs;
+	double exec_ms;
+	uint64_t samples;
+	/* Number and total size of allocations made by the sandbox allocator */
+	uint64_t allocations;
+	uint64_t allocated_bytes;
+	size_t memory_peak;
+	/* Sample counts by collapsed call stack, outermost function first, e.g. "main:3;parse:40" */
+	std::unordered_map<std::string, uint64_t> stacks;
+	/* Calls and time spent in each native binding, e.g. save() or create_message() */
+	std::unordered_map<std::string, binding_time> bindings;
+
+	script_profile();
+
+	/* Summary for the dashboard and the sudo jsprofile command */
+	json Summary() const;
+};
+
+/**
+ * Profiles one run of a script, adding to the channel's script_profile. The call stack is sampled
+ * from the execution timeout hook, so a script being profiled costs nothing extra between samples.
+ */
+class ScriptProfiler {
+	duk_context* ctx;
+	script_profile &profile;
+public:
+	ScriptProfiler(duk_context* run_ctx, script_profile &p);
+
+	/* Record the current call stack of the script. Only safe to call from the timeout hook. */
+	void Sample();
+
+	/* Record a native binding being called, and the time it took once it returns */
+	void BindingCall(const char* name);
+	void BindingTime(const char* name, double ms);
+};
@@ -0,0 +1,479 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+#include <sys/time.h>
+#include <sporks/stringops.h>
+#include "sandbox.h"
+#include "kvcache.h"
+#include "marshal.h"
+
+std::shared_ptr<spdlog::logger> sandbox_log;
+
+static duk_ret_t sandbox_dispatch(duk_context *cx);
+
+/**
+ * Find the heap a binding is being called on. Its udata is the sandbox_heap.
+ */
+sandbox_heap* sandbox_get_heap(duk_context *cx)
+{
+	duk_memory_functions funcs;
+	duk_get_memory_functions(cx, &funcs);
+	return (sandbox_heap*)funcs.udata;
+}
+
+sandbox_context* sandbox_get_context(duk_context *cx)
+{
+	return sandbox_get_heap(cx)->context;
+}
+
+static void define_func(duk_context* ctx, const std::string &name, duk_int_t magic, int nargs)
+{
+	duk_push_string(ctx, name.c_str());
+	duk_push_c_function(ctx, sandbox_dispatch, nargs);
+	duk_set_magic(ctx, -1, magic);
+	duk_def_prop(ctx, -3, DUK_DEFPROP_HAVE_VALUE);
+}
+
+static void define_string(duk_context* ctx, const std::string &name, const std::string &value)
+{
+	duk_push_string(ctx, name.c_str());
+	duk_push_string(ctx, value.c_str());
+	duk_def_prop(ctx, -3, DUK_DEFPROP_HAVE_VALUE);
+}
+
+duk_ret_t sandbox_debuglog(duk_context *cx)
+{
+	int argc = duk_get_top(cx);
+	std::string output;
+	if (argc < 1)
+		return 0;
+	for (int i = 0; i < argc; i++)
+		output.append(duk_to_string(cx, i - argc)).append(" ");
+	sandbox_log->debug("JS debuglog(): {}", trim(output));
+	return 0;
+}
+
+duk_ret_t sandbox_load(duk_context *cx)
+{
+	sandbox_context* context = sandbox_get_context(cx);
+	int argc = duk_get_top(cx);
+	if (argc != 1) {
+		sandbox_log->warn("JS load(): incorrect number of parameters: {}", argc);
+		return 0;
+	}
+	if (!duk_is_string(cx, -1)) {
+		sandbox_log->warn("JS load(): parameter is not a string");
+		return 0;
+	}
+	std::string keyname = duk_get_string(cx, -1);
+	std::string value;
+	if (context->kv->Get(context->guild_id, keyname, value)) {
+		duk_push_string(cx, value.c_str());
+		return 1;
+	} else {
+		return 0;
+	}
+}
+
+duk_ret_t sandbox_delete(duk_context *cx)
+{
+	sandbox_context* context = sandbox_get_context(cx);
+	int argc = duk_get_top(cx);
+	if (argc != 1) {
+		sandbox_log->warn("JS delete(): incorrect number of parameters: {}", argc);
+		return 0;
+	}
+	if (!duk_is_string(cx, -1)) {
+		sandbox_log->warn("JS delete(): parameter is not a string");
+		return 0;
+	}
+	std::string keyname = duk_get_string(cx, -1);
+	context->kv->Delete(context->guild_id, keyname);
+	return 0;
+}
+
+duk_ret_t sandbox_save(duk_context *cx)
+{
+	sandbox_context* context = sandbox_get_context(cx);
+	int argc = duk_get_top(cx);
+	if (argc != 2) {
+		sandbox_log->warn("JS save(): incorrect number of parameters: {}", argc);
+		return 0;
+	}
+	if (!duk_is_string(cx, 0)) {
+		sandbox_log->warn("JS save(): first parameter is not a string");
+		return 0;
+	}
+	if (!duk_is_string(cx, -1)) {
+		sandbox_log->warn("JS save(): second parameter is not a string");
+		return 0;
+	}
+	std::string keyname = duk_get_string(cx, 0);
+	std::string value = duk_get_string(cx, -1);
+	context->kv->Set(context->guild_id, keyname, value);
+	return 0;
+}
+
+/**
+ * exit() raises the same flag as the execution timeout, so the error it throws can't be caught
+ * by the script (see check_exec_timeout()), and no other binding will run after it.
+ */
+duk_ret_t sandbox_exit(duk_context *cx)
+{
+	int argc = duk_get_top(cx);
+	if (argc != 1) {
+		sandbox_log->warn("JS exit(): incorrect number of parameters: {}", argc);
+	}
+	sandbox_get_heap(cx)->timer.interrupt = 1;
+	duk_push_error_object(cx, DUK_ERR_ERROR, "exit");
+	return duk_throw(cx);
+}
+
+/**
+ * Inject the per-message variables (message, author, channel etc) as properties of the
+ * global object. Run via duk_safe_call() as building them can throw, e.g. when out of memory.
+ */
+static duk_ret_t inject_vars(duk_context *cx, void* udata)
+{
+	const std::unordered_map<std::string, json> &vars = *((const std::unordered_map<std::string, json>*)udata);
+	duk_push_global_object(cx);
+	for (auto i = vars.begin(); i != vars.end(); ++i) {
+		push_json(cx, i->second);
+		duk_put_prop_string(cx, -2, i->first.c_str());
+	}
+	duk_pop(cx);
+	return 0;
+}
+
+/**
+ * Load previously dumped bytecode as a function on top of the stack. Run via duk_safe_call().
+ */
+static duk_ret_t load_bytecode(duk_context *cx, void* udata)
+{
+	const std::string &bytecode = *((const std::string*)udata);
+	void* buffer = duk_push_fixed_buffer(cx, bytecode.length());
+	memcpy(buffer, bytecode.data(), bytecode.length());
+	duk_load_function(cx);
+	return 1;
+}
+
+/**
+ * Dump the compiled function on top of the stack to a string, leaving the function in place.
+ */
+static duk_ret_t dump_bytecode(duk_context *cx, void* udata)
+{
+	std::string &bytecode = *((std::string*)udata);
+	duk_size_t size = 0;
+	duk_dup_top(cx);
+	duk_dump_function(cx);
+	void* buffer = duk_get_buffer_data(cx, -1, &size);
+	bytecode = std::string((const char*)buffer, size);
+	duk_pop(cx);
+	return 0;
+}
+
+/**
+ * All bindings are called through here. Once a script has called exit() it may still run
+ * a few instructions inside a catch block before the interrupt is noticed, but it can't
+ * call anything with a side effect.
+ */
+static duk_ret_t sandbox_dispatch(duk_context *cx)
+{
+	sandbox_heap* heap = sandbox_get_heap(cx);
+	if (heap->timer.interrupt) {
+		duk_push_error_object(cx, DUK_ERR_ERROR, "exit");
+		return duk_throw(cx);
+	}
+	const sandbox_binding &b = heap->context->bindings[duk_get_current_magic(cx)];
+	ScriptProfiler* profiler = heap->profiler;
+	if (!profiler) {
+		return b.func(cx);
+	}
+	/* A binding which throws is counted, but its time isn't */
+	profiler->BindingCall(b.name);
+	auto start = std::chrono::steady_clock::now();
+	duk_ret_t rv = b.func(cx);
+	profiler->BindingTime(b.name, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+	return rv;
+}
+
+bool sandbox_compile(sandbox_heap* heap, sandbox_script &script)
+{
+	duk_context* ctx = heap->ctx;
+	duk_push_string(ctx, script.name.c_str());
+	if (duk_pcompile_string_filename(ctx, 0, script.source.c_str()) == 0) {
+		std::string dumped;
+		if (duk_safe_call(ctx, dump_bytecode, (void*)&dumped, 0, 1) == DUK_EXEC_SUCCESS) {
+			script.bytecode[""] = dumped;
+		}
+		duk_pop(ctx);
+	} else {
+		script.compile_error = duk_safe_to_string(ctx, -1);
+	}
+	duk_pop(ctx);
+	return script.compile_error.empty();
+}
+
+/**
+ * Timeout hook sampler, only set while a run is being profiled. Taking a sample allocates, so
+ * it is skipped rather than push a script which is nearly out of memory over its quota.
+ */
+static void sandbox_sample(void* udata)
+{
+	sandbox_heap* heap = (sandbox_heap*)udata;
+	if (heap->profiler && heap->allocated + profile_sample_headroom < heap->limit) {
+		heap->profiler->Sample();
+	}
+}
+
+/**
+ * Run a script on a thread of a pooled heap, with the context and quotas already set up
+ */
+static bool sandbox_execute(duk_context* ctx, sandbox_heap* heap, sandbox_script &v, const std::unordered_map<std::string, json> &vars, const std::string &callback_fn, const std::string &callback_content, js_run &stats)
+{
+	duk_int_t ret;
+	sandbox_timer &timer = heap->timer;
+	sandbox_context* context = heap->context;
+
+	auto t_start = std::chrono::high_resolution_clock::now();	
+
+	duk_push_global_object(ctx);
+	define_string(ctx, "CHANNEL_ID", std::to_string(context->channel_id));
+	define_string(ctx, "GUILD_ID", std::to_string(context->guild_id));
+	define_string(ctx, "BOT_ID", std::to_string(context->bot_id));
+	for (size_t i = 0; i < context->binding_count; ++i) {
+		define_func(ctx, context->bindings[i].name, i, context->bindings[i].nargs);
+	}
+	if (!callback_fn.empty()) {
+		define_string(ctx, "WCB_CONTENT", callback_content);
+	}
+	duk_pop(ctx);
+
+	if (duk_safe_call(ctx, inject_vars, (void*)&vars, 0, 1) != DUK_EXEC_SUCCESS) {
+		stats.error = duk_safe_to_string(ctx, -1);
+		sandbox_log->error("JS error: {}", stats.error);
+		return false;
+	}
+	duk_pop(ctx);
+
+	/* Use the cached bytecode for this entry point if we have it, otherwise compile the source and cache the result */
+	auto bytecode = v.bytecode.find(callback_fn);
+	if (bytecode == v.bytecode.end() && callback_fn.empty() && !v.compile_error.empty()) {
+		/* Already known not to compile, from when it was loaded */
+		stats.error = v.compile_error;
+		return false;
+	}
+	if (bytecode != v.bytecode.end()) {
+		if (duk_safe_call(ctx, load_bytecode, (void*)&bytecode->second, 0, 1) != DUK_EXEC_SUCCESS) {
+			stats.error = duk_safe_to_string(ctx, -1);
+			sandbox_log->error("couldnt load bytecode: {}", stats.error);
+			v.bytecode.erase(bytecode);
+			return false;
+		}
+	} else {
+		duk_push_string(ctx, v.name.c_str());
+		std::string source;
+		if (!callback_fn.empty()) {
+			source = callback_fn + "(WCB_CONTENT);exit(0);" + v.source;
+		} else {
+			source = v.source;
+		}
+
+		if (duk_pcompile_string_filename(ctx, 0, source.c_str()) != 0) {
+			stats.error = duk_safe_to_string(ctx, -1);
+			sandbox_log->error("couldnt compile: {}", stats.error);
+			auto t_end = std::chrono::high_resolution_clock::now();
+			stats.compile_ms = std::chrono::duration<double, std::milli>(t_end-t_start).count();
+			return false;
+		}
+
+		if (callback_fn.empty() || v.bytecode.size() < max_cached_callbacks) {
+			std::string dumped;
+			if (duk_safe_call(ctx, dump_bytecode, (void*)&dumped, 0, 1) == DUK_EXEC_SUCCESS) {
+				v.bytecode[callback_fn] = dumped;
+			}
+			duk_pop(ctx);
+		}
+	}
+
+	auto t_end = std::chrono::high_resolution_clock::now();
+	stats.compile_ms = std::chrono::duration<double, std::milli>(t_end-t_start).count();
+
+	if (!duk_is_function(ctx, -1)) {
+		stats.error = "Top of stack is not a function";
+		sandbox_log->error("JS error: {}", stats.error);
+		return false;
+	}
+
+	/* Profiling is switched on and off by the channel's profile column */
+	std::unique_ptr<ScriptProfiler> profiler;
+	if (v.profiling) {
+		if (!v.profile) {
+			v.profile.reset(new script_profile());
+		}
+		profiler.reset(new ScriptProfiler(ctx, *v.profile));
+		heap->profiler = profiler.get();
+		timer.sample = sandbox_sample;
+		timer.sample_interval = profile_sample_us;
+		timer.next_sample = profile_sample_us;
+	} else if (v.profile) {
+		v.profile.reset();
+	}
+
+	gettimeofday(&timer.start, nullptr);
+	ret = duk_pcall(ctx, 0);
+	gettimeofday(&timer.now, nullptr);
+	heap->profiler = nullptr;
+	timer.sample = NULL;
+	if (timer.interrupt) {
+		/* Graceful exit from javascript via exit() */
+		ret = DUK_EXEC_SUCCESS;
+	}
+	stats.executed = true;
+	stats.exec_ms = (double)((timer.now.tv_sec - timer.start.tv_sec) * 1000000 + timer.now.tv_usec - timer.start.tv_usec) / 1000;
+	stats.memory = heap->peak - heap->overhead;
+
+	if (profiler) {
+		v.profile->runs++;
+		v.profile->exec_ms += stats.exec_ms;
+		v.profile->allocations += heap->allocations;
+		v.profile->allocated_bytes += heap->allocated_bytes;
+		v.profile->memory_peak = std::max(v.profile->memory_peak, stats.memory);
+		stats.profile = v.profile->Summary().dump();
+	}
+
+	if (ret != DUK_EXEC_SUCCESS) {
+		if (duk_is_error(ctx, -1)) {
+			duk_get_prop_string(ctx, -1, "stack");
+			stats.error = duk_safe_to_string(ctx, -1);
+			duk_pop(ctx);
+		} else {
+			stats.error = duk_safe_to_string(ctx, -1);
+		}
+		sandbox_log->error("JS error: {}", stats.error);
+		return false;
+	}
+	return true;
+}
+
+bool sandbox_run(sandbox_heap* heap, sandbox_script &script, const std::unordered_map<std::string, json> &vars, const std::string &callback_fn, const std::string &callback_content, js_run &stats)
+{
+	bool rv = false;
+	try {
+		/* Each run gets a new thread with its own global environment, so nothing is shared with the heap's previous runs */
+		duk_push_thread_new_globalenv(heap->ctx);
+		/* A new heap wouldn't have had a second set of built-ins, so scripts keep the same headroom they had before pooling */
+		heap->overhead = heap->allocated - heap->baseline;
+		heap->limit += heap->overhead;
+		heap->peak = heap->allocated;
+		heap->allocations = heap->allocated_bytes = 0;
+		rv = sandbox_execute(duk_get_context(heap->ctx, -1), heap, script, vars, callback_fn, callback_content, stats);
+	}
+	catch (const std::exception &e) {
+		/* Fatal error, or a C++ exception thrown out through Duktape. Either way the heap can't be trusted any more. */
+		heap->poisoned = true;
+		heap->profiler = nullptr;
+		heap->timer.sample = NULL;
+		stats.error = e.what();
+		sandbox_log->error("JS error: {}", stats.error);
+	}
+	stats.failed = !rv;
+	return rv;
+}
+
+void sandbox_fatal(void *udata, const char *msg) {
+	// Yeah, according to the docs a fatal can never return. Technically, it doesnt.
+	// The heap is marked so that it is never used again.
+	std::string error = msg;
+	((sandbox_heap*)udata)->poisoned = true;
+	throw std::runtime_error("JS error: " + error);
+}
+
+/**
+ * The sandbox allocators charge each allocation to the heap's quota, and take the memory
+ * from the heap's own arena rather than directly from malloc().
+ */
+void sandbox_free(void *udata, void *ptr) {
+	sandbox_heap* heap = (sandbox_heap*)udata;
+
+	if (!ptr) {
+		return;
+	}
+	heap->allocated -= SandboxArena::Size(ptr);
+	heap->arena.Free(ptr);
+}
+
+void *sandbox_alloc(void *udata, duk_size_t size) {
+	sandbox_heap* heap = (sandbox_heap*)udata;
+
+	if (size == 0) {
+		return NULL;
+	}
+
+	if (heap->allocated + size > heap->limit) {
+		sandbox_log->error("Sandbox maximum allocation size reached, {} requested in sandbox_alloc", (long) size);
+		return NULL;
+	}
+
+	void* ptr = heap->arena.Alloc(size);
+	if (!ptr) {
+		return NULL;
+	}
+	heap->allocated += size;
+	heap->peak = std::max(heap->peak, heap->allocated);
+	heap->allocations++;
+	heap->allocated_bytes += size;
+	return ptr;
+}
+
+void *sandbox_realloc(void *udata, void *ptr, duk_size_t size) {
+	sandbox_heap* heap = (sandbox_heap*)udata;
+
+	if (!ptr) {
+		return sandbox_alloc(udata, size);
+	}
+
+	size_t old_size = SandboxArena::Size(ptr);
+	if (size == 0) {
+		heap->allocated -= old_size;
+		heap->arena.Free(ptr);
+		return NULL;
+	}
+
+	if (heap->allocated - old_size + size > heap->limit) {
+		sandbox_log->error("Sandbox maximum allocation size reached, {} requested in sandbox_realloc", (long) size);
+		return NULL;
+	}
+
+	void* t = heap->arena.Realloc(ptr, size);
+	if (!t) {
+		return NULL;
+	}
+	heap->allocated -= old_size;
+	heap->allocated += size;
+	heap->peak = std::max(heap->peak, heap->allocated);
+	heap->allocations++;
+	heap->allocated_bytes += (size > old_size ? size - old_size : 0);
+	return t;
+}
@@ -0,0 +1,123 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <unordered_map>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+#include <spdlog/spdlog.h>
+#include "duktape.h"
+#include "heappool.h"
+#include "profiler.h"
+#include "telemetry.h"
+
+using json = nlohmann::json;
+
+namespace aegis {
+	class guild;
+};
+
+class KVCache;
+
+/* Maximum number of distinct web request callbacks whose compiled form is cached per script */
+const size_t max_cached_callbacks = 16;
+
+/* Where the sandbox and its bindings log to. Set by whoever runs scripts before the first run. */
+extern std::shared_ptr<spdlog::logger> sandbox_log;
+
+/**
+ * A native function available to scripts. A table of these is given to each run, and the index
+ * of a binding in its table is its magic number (see sandbox_dispatch()).
+ */
+struct sandbox_binding {
+	const char* name;
+	duk_c_function func;
+	duk_idx_t nargs;
+};
+
+/**
+ * Everything a binding needs to know about the script which called it. One of these lives
+ * for the duration of each run, and the heap the script runs on points at it.
+ */
+struct sandbox_context {
+	/* Given to the script as CHANNEL_ID, GUILD_ID and BOT_ID */
+	int64_t channel_id;
+	int64_t guild_id;
+	int64_t bot_id;
+	/* The guild, for bindings which look up its members and channels. Not used by the sandbox itself. */
+	aegis::guild* guild;
+	/* Messages sent by the script so far */
+	uint32_t message_total;
+	/* Backs the save(), load() and delete() bindings */
+	KVCache* kv;
+	/* The bindings the script can call */
+	const sandbox_binding* bindings;
+	size_t binding_count;
+};
+
+/**
+ * A script, and the compiled forms of it which are cached between runs
+ */
+struct sandbox_script {
+	std::string name;
+	std::string source;
+	/* Compiled bytecode, keyed by callback function name ("" for the main program). The main program is
+	 * compiled before the script is published, after which this is only ever touched by the channel's worker.
+	 */
+	std::unordered_map<std::string, std::string> bytecode;
+	/* Set if the main program failed to compile when it was loaded */
+	std::string compile_error;
+	/* Set from the profile column, and changed in place when it changes */
+	std::atomic<bool> profiling;
+	/* Profile of runs since profiling was switched on. Only ever touched by the channel's worker. */
+	std::unique_ptr<script_profile> profile;
+};
+
+/* The allocator and fatal error functions to give a HeapPool, which charge every allocation to the heap's quota */
+void* sandbox_alloc(void* udata, duk_size_t size);
+void* sandbox_realloc(void* udata, void* ptr, duk_size_t size);
+void sandbox_free(void* udata, void* ptr);
+void sandbox_fatal(void* udata, const char* msg);
+
+/* Find the heap, or the context of the script, a binding is being called for */
+sandbox_heap* sandbox_get_heap(duk_context* cx);
+sandbox_context* sandbox_get_context(duk_context* cx);
+
+/* Compile a script's main program on an idle heap, caching its bytecode. Returns false and sets
+ * compile_error if it doesn't compile.
+ */
+bool sandbox_compile(sandbox_heap* heap, sandbox_script &script);
+
+/* Run a script on a heap from the pool, whose context and timeout have already been set. Every run
+ * gets a fresh global environment with the context's bindings and the given variables. If
+ * callback_fn is set, that function of the script is called with callback_content instead of
+ * running the main program. Fills in stats, and returns true if the script ran without error.
+ */
+bool sandbox_run(sandbox_heap* heap, sandbox_script &script, const std::unordered_map<std::string, json> &vars, const std::string &callback_fn, const std::string &callback_content, js_run &stats);
+
+/* Bindings which only touch the sandbox and the key/value store, for any binding table */
+duk_ret_t sandbox_debuglog(duk_context* cx);
+duk_ret_t sandbox_save(duk_context* cx);
+duk_ret_t sandbox_load(duk_context* cx);
+duk_ret_t sandbox_delete(duk_context* cx);
+duk_ret_t sandbox_exit(duk_context* cx);
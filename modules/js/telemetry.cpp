@@ -0,0 +1,197 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <algorithm>
+#include <vector>
+#include <chrono>
+#include <sporks/database.h>
+#include "telemetry.h"
+
+/* Columns set from each channel's statistics, see Flush() */
+static const char* telemetry_columns[] = {
+	"last_compile_ms", "last_exec_ms", "last_memory_max", "last_error",
+	"exec_ms_min", "exec_ms_max", "exec_ms_p95", "memory_peak", "window_runs", "window_errors"
+};
+
+JSTelemetry::JSTelemetry() : terminate(false)
+{
+	flusher = new std::thread(&JSTelemetry::FlushThread, this);
+}
+
+JSTelemetry::~JSTelemetry()
+{
+	terminate = true;
+	flusher->join();
+	delete flusher;
+	Flush();
+}
+
+void JSTelemetry::FlushThread()
+{
+	int elapsed = 0;
+	while (!terminate) {
+		/* Sleep in short steps so that shutting down isn't held up */
+		std::this_thread::sleep_for(std::chrono::milliseconds(250));
+		if (++elapsed >= telemetry_flush_seconds * 4) {
+			Flush();
+			elapsed = 0;
+		}
+	}
+}
+
+void JSTelemetry::Record(int64_t channel_id, const js_run &run)
+{
+	std::lock_guard<std::mutex> stats_lock(stats_mutex);
+	channel_stats &c = channels[channel_id];
+	if (!run.executed) {
+		/* Keep the last execution figures, as the run never got that far */
+		double exec_ms = c.last.exec_ms;
+		size_t memory = c.last.memory;
+		c.last = run;
+		c.last.exec_ms = exec_ms;
+		c.last.memory = memory;
+	} else {
+		c.last = run;
+	}
+	c.window.push_back({ (float)run.exec_ms, (uint32_t)run.memory, run.executed, run.failed });
+	if (c.window.size() > telemetry_window) {
+		c.window.pop_front();
+	}
+	c.runs++;
+	c.errors += (run.failed ? 1 : 0);
+	c.dirty = true;
+	if (!run.profile.empty()) {
+		c.profile = run.profile;
+		c.profile_dirty = true;
+	}
+}
+
+/**
+ * A script compiled after the channel's last run replaces that run's compile time and error,
+ * so whichever happened last is what ends up in the database.
+ */
+void JSTelemetry::RecordCompile(int64_t channel_id, double compile_ms, const std::string &error)
+{
+	std::lock_guard<std::mutex> stats_lock(stats_mutex);
+	compiles[channel_id] = std::make_pair(compile_ms, error);
+	auto c = channels.find(channel_id);
+	if (c != channels.end() && c->second.dirty) {
+		c->second.last.compile_ms = compile_ms;
+		c->second.last.failed = !error.empty();
+		c->second.last.error = error;
+	}
+}
+
+/**
+ * Every outstanding channel is written with one UPDATE per telemetry_batch channels, joining
+ * the table against a derived table of the new values. An UPDATE is used rather than an upsert
+ * so that statistics for a channel whose script has just been removed can't recreate its row.
+ */
+size_t JSTelemetry::Flush()
+{
+	std::vector<std::pair<int64_t, db::paramlist>> pending;
+	std::vector<std::pair<int64_t, std::string>> profiles;
+	std::vector<std::pair<int64_t, std::pair<double, std::string>>> compiled;
+	{
+		std::lock_guard<std::mutex> stats_lock(stats_mutex);
+		compiled.assign(compiles.begin(), compiles.end());
+		compiles.clear();
+		for (auto i = channels.begin(); i != channels.end(); ++i) {
+			channel_stats &c = i->second;
+			if (c.profile_dirty) {
+				profiles.emplace_back(i->first, std::move(c.profile));
+				c.profile.clear();
+				c.profile_dirty = false;
+			}
+			if (!c.dirty) {
+				continue;
+			}
+			std::vector<float> times;
+			uint32_t peak = 0;
+			uint64_t window_errors = 0;
+			for (auto s = c.window.begin(); s != c.window.end(); ++s) {
+				if (s->executed) {
+					times.push_back(s->exec_ms);
+					peak = std::max(peak, s->memory);
+				}
+				window_errors += (s->failed ? 1 : 0);
+			}
+			float min = 0, max = 0, p95 = 0;
+			if (!times.empty()) {
+				auto minmax = std::minmax_element(times.begin(), times.end());
+				min = *minmax.first;
+				max = *minmax.second;
+				auto p = times.begin() + (times.size() * 95) / 100;
+				if (p == times.end()) {
+					--p;
+				}
+				std::nth_element(times.begin(), p, times.end());
+				p95 = *p;
+			}
+			pending.emplace_back(i->first, db::paramlist{
+				i->first, (float)c.last.compile_ms, (float)c.last.exec_ms, (uint64_t)c.last.memory, (c.last.failed ? c.last.error : std::string()),
+				min, max, p95, (uint64_t)peak, (uint64_t)c.window.size(), window_errors, c.runs, c.errors
+			});
+			c.runs = c.errors = 0;
+			c.dirty = false;
+		}
+	}
+
+	/* Compile results first, so that a run since then overwrites them */
+	for (size_t start = 0; start < compiled.size(); start += telemetry_batch) {
+		size_t end = std::min(compiled.size(), start + telemetry_batch);
+		std::string values;
+		db::paramlist params;
+		for (size_t i = start; i < end; ++i) {
+			values += (i == start ? "SELECT ? AS id, ? AS last_compile_ms, '?' AS last_error" : " UNION ALL SELECT ?, ?, '?'");
+			params.emplace_back(compiled[i].first);
+			params.emplace_back((float)compiled[i].second.first);
+			params.emplace_back(compiled[i].second.second);
+		}
+		db::query("UPDATE infobot_discord_javascript j JOIN (" + values + ") s ON j.id = s.id SET j.last_compile_ms = s.last_compile_ms, j.last_error = s.last_error", params);
+	}
+
+	for (size_t start = 0; start < pending.size(); start += telemetry_batch) {
+		size_t end = std::min(pending.size(), start + telemetry_batch);
+		std::string values;
+		db::paramlist params;
+		for (size_t i = start; i < end; ++i) {
+			if (i == start) {
+				values = "SELECT ? AS id, ? AS last_compile_ms, ? AS last_exec_ms, ? AS last_memory_max, '?' AS last_error, ? AS exec_ms_min, ? AS exec_ms_max, "
+					"? AS exec_ms_p95, ? AS memory_peak, ? AS window_runs, ? AS window_errors, ? AS runs, ? AS errors";
+			} else {
+				values += " UNION ALL SELECT ?, ?, ?, ?, '?', ?, ?, ?, ?, ?, ?, ?, ?";
+			}
+			params.insert(params.end(), pending[i].second.begin(), pending[i].second.end());
+		}
+		std::string set;
+		for (size_t c = 0; c < sizeof(telemetry_columns) / sizeof(telemetry_columns[0]); ++c) {
+			set += std::string("j.") + telemetry_columns[c] + " = s." + telemetry_columns[c] + ", ";
+		}
+		db::query("UPDATE infobot_discord_javascript j JOIN (" + values + ") s ON j.id = s.id SET " + set +
+			"j.total_runs = j.total_runs + s.runs, j.total_errors = j.total_errors + s.errors", params);
+	}
+
+	/* Profiling is opt-in and the summaries are large, so they are written one at a time */
+	for (auto & p : profiles) {
+		db::query("UPDATE infobot_discord_javascript SET profile_summary = '?' WHERE id = ?", {p.second, p.first});
+	}
+	return pending.size() + compiled.size();
+}
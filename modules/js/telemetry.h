@@ -0,0 +1,118 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <unordered_map>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+/* How often collected statistics are written to the database, in seconds */
+const int telemetry_flush_seconds = 5;
+
+/* Number of most recent runs the rolling statistics are taken over */
+const size_t telemetry_window = 100;
+
+/* Maximum channels written per UPDATE statement */
+const size_t telemetry_batch = 100;
+
+/**
+ * The outcome of one run of a channel's script
+ */
+struct js_run {
+	/* Time taken to load or compile the script, in milliseconds */
+	double compile_ms;
+	/* True if the script got as far as executing */
+	bool executed;
+	/* Time spent executing the script, in milliseconds */
+	double exec_ms;
+	/* Peak memory used by the script, in bytes */
+	size_t memory;
+	/* True if the run failed, in which case error says why */
+	bool failed;
+	std::string error;
+	/* JSON summary of the channel's profile including this run, empty if it isn't being profiled */
+	std::string profile;
+};
+
+/**
+ * JSTelemetry collects statistics about every run of every channel's script in memory, and
+ * writes them to infobot_discord_javascript every few seconds in a few batched statements,
+ * rather than the run itself making several writes. Only channels which ran since the last
+ * write are written.
+ *
+ * Alongside the last sample, the minimum, maximum and 95th percentile execution time, peak
+ * memory and error count over the last telemetry_window runs are kept, plus running totals.
+ * Channels being profiled also have their latest profile summary written.
+ */
+class JSTelemetry {
+
+	/* One run, as kept in the rolling window */
+	struct sample {
+		float exec_ms;
+		uint32_t memory;
+		bool executed;
+		bool failed;
+	};
+
+	struct channel_stats {
+		js_run last;
+		std::deque<sample> window;
+		/* Runs and errors since the last write, added to the totals in the database */
+		uint64_t runs;
+		uint64_t errors;
+		/* True if there is anything not yet written */
+		bool dirty;
+		/* Latest profile summary, and whether it has been written */
+		std::string profile;
+		bool profile_dirty;
+	};
+
+	std::unordered_map<int64_t, channel_stats> channels;
+
+	/* Compile results not yet written, by channel. These don't touch the run statistics. */
+	std::unordered_map<int64_t, std::pair<double, std::string>> compiles;
+
+	std::mutex stats_mutex;
+
+	std::thread* flusher;
+	std::atomic<bool> terminate;
+
+	/* Flusher thread body */
+	void FlushThread();
+
+public:
+	JSTelemetry();
+
+	/* Writes anything outstanding before returning */
+	~JSTelemetry();
+
+	/* Record a run of a channel's script */
+	void Record(int64_t channel_id, const js_run &run);
+
+	/* Record a channel's script being compiled when it was loaded or saved. error is empty if it compiled. */
+	void RecordCompile(int64_t channel_id, double compile_ms, const std::string &error);
+
+	/* Write all outstanding statistics to the database now. Returns the number of channel updates written. */
+	size_t Flush();
+};
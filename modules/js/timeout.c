@@ -19,19 +19,31 @@
  ************************************************************************************/
 
 #include "duktape.h"
-#include <sys/time.h>
-
-int interrupt = 0;
-struct timeval t_script_start;
-struct timeval t_script_now;
-
-extern uint64_t timeout;
+#include "timeout.h"
 
 duk_bool_t check_exec_timeout(void *udata)
 {
-	gettimeofday(&t_script_now, NULL);
-	uint64_t microsecs = (t_script_now.tv_sec - t_script_start.tv_sec) * 1000000 + t_script_now.tv_usec - t_script_start.tv_usec;
+	struct sandbox_timer* timer = (struct sandbox_timer*)udata;
+	if (!timer) {
+		return 0;
+	}
+	/* Set by exit(). Keep reporting a timeout until the error has bubbled all the way out of the script */
+	if (timer->interrupt) {
+		return 1;
+	}
+	gettimeofday(&timer->now, NULL);
+	uint64_t microsecs = (timer->now.tv_sec - timer->start.tv_sec) * 1000000 + timer->now.tv_usec - timer->start.tv_usec;
 
-        return (microsecs > (timeout * 1000) ? 1 : 0);
+	if (microsecs > timer->timeout * 1000) {
+		return 1;
+	}
+	if (timer->sample && microsecs >= timer->next_sample) {
+		/* Cleared while sampling, in case sampling itself ends up back here */
+		void (*sample)(void*) = timer->sample;
+		timer->next_sample = microsecs + timer->sample_interval;
+		timer->sample = NULL;
+		sample(udata);
+		timer->sample = sample;
+	}
+	return 0;
 }
-
@@ -0,0 +1,49 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <stdint.h>
+#include <sys/time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Execution time limit for one run of a script. This is the first member of the heap udata,
+ * so check_exec_timeout() can find it without knowing anything else about the heap.
+ */
+struct sandbox_timer {
+	struct timeval start;
+	struct timeval now;
+	/* Maximum run time, in milliseconds */
+	uint64_t timeout;
+	/* Set by exit(), makes every later timeout check fail */
+	int interrupt;
+	/* If set, called with the heap udata every sample_interval microseconds of run time, to profile the script */
+	void (*sample)(void* udata);
+	uint64_t sample_interval;
+	/* Run time at which the next sample is due, in microseconds */
+	uint64_t next_sample;
+};
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,89 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <algorithm>
+#include "workerpool.h"
+
+WorkerPool::WorkerPool(size_t count) : terminate(false)
+{
+	count = std::max((size_t)1, count);
+	for (size_t i = 0; i < count; ++i) {
+		worker* w = new worker();
+		workers.push_back(w);
+		w->thread = new std::thread(&WorkerPool::Run, this, w);
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	terminate = true;
+	for (auto w = workers.begin(); w != workers.end(); ++w) {
+		{
+			std::lock_guard<std::mutex> queue_lock((*w)->queue_mutex);
+			(*w)->queue_cv.notify_one();
+		}
+		(*w)->thread->join();
+		delete (*w)->thread;
+		delete *w;
+	}
+}
+
+void WorkerPool::Run(worker* w)
+{
+	while (true) {
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> queue_lock(w->queue_mutex);
+			w->queue_cv.wait(queue_lock, [this, w]() {
+				return terminate || !w->queue.empty();
+			});
+			if (w->queue.empty()) {
+				/* Only reached when terminating, with nothing left to do */
+				return;
+			}
+			job = std::move(w->queue.front());
+			w->queue.pop_front();
+		}
+		job();
+	}
+}
+
+void WorkerPool::Submit(uint64_t key, const std::function<void()> &job)
+{
+	worker* w = workers[key % workers.size()];
+	std::lock_guard<std::mutex> queue_lock(w->queue_mutex);
+	w->queue.push_back(job);
+	w->queue_cv.notify_one();
+}
+
+size_t WorkerPool::Size()
+{
+	return workers.size();
+}
+
+size_t WorkerPool::Pending()
+{
+	size_t pending = 0;
+	for (auto w = workers.begin(); w != workers.end(); ++w) {
+		std::lock_guard<std::mutex> queue_lock((*w)->queue_mutex);
+		pending += (*w)->queue.size();
+	}
+	return pending;
+}
@@ -0,0 +1,65 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <cstdint>
+
+/**
+ * A fixed set of worker threads, each with its own queue of jobs. Jobs are given a key and
+ * every job with the same key goes to the same worker, so jobs for one key run one at a time
+ * and in the order they were submitted, while jobs for different keys can run at once.
+ */
+class WorkerPool {
+
+	struct worker {
+		std::thread* thread;
+		std::deque<std::function<void()>> queue;
+		std::mutex queue_mutex;
+		std::condition_variable queue_cv;
+	};
+
+	std::vector<worker*> workers;
+	std::atomic<bool> terminate;
+
+	/* Worker thread body */
+	void Run(worker* w);
+
+public:
+	WorkerPool(size_t count);
+
+	/* Runs any jobs still queued, then stops the workers */
+	~WorkerPool();
+
+	/* Queue a job on the worker responsible for the key */
+	void Submit(uint64_t key, const std::function<void()> &job);
+
+	/* Number of worker threads */
+	size_t Size();
+
+	/* Number of jobs waiting to run across all workers */
+	size_t Pending();
+};
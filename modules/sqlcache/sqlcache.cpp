@@ -25,9 +25,87 @@
 #include <sporks/config.h>
 #include <sstream>
 #include <thread>
+#include <chrono>
+#include <vector>
+#include <queue>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <unordered_map>
+
+/* Bounds on the number of users written per statement, and the size the writer starts at */
+const size_t user_batch_min = 50;
+const size_t user_batch_max = 1000;
+const size_t user_batch_start = 200;
+
+/* Statement time the user batch size is adjusted towards, in milliseconds */
+const double user_batch_target_ms = 250;
+
+/* Seconds over which the user cache write rate is measured */
+const time_t user_rate_window = 10;
+
+/* Most distinct users waiting to be written. The guild thread waits for room rather than exceed this. */
+const size_t user_queue_limit = 500000;
+
+/* Most guilds waiting to be processed. Guilds arriving when it is full are dropped, as the
+ * gateway thread which queues them must never block.
+ */
+const size_t guild_queue_limit = 5000;
+
+/* Longest a queue thread sleeps without work, so it still updates its rate and log line */
+const std::chrono::seconds queue_idle_wait(1);
+
+/**
+ * What was last written for one member of a guild, as hashes of the membership row and the user row
+ */
+struct member_fingerprint {
+	int64_t id;
+	uint64_t membership;
+	uint64_t user;
+};
+
+/**
+ * What was last written for a guild. Members are kept sorted by id, which makes this a few
+ * bytes per member. Channels are hashed on the name and parent that getSettings() records.
+ */
+struct guild_fingerprint {
+	std::vector<member_fingerprint> members;
+	std::unordered_map<int64_t, uint64_t> channels;
+};
+
+static bool fingerprint_less(const member_fingerprint &a, const member_fingerprint &b)
+{
+	return a.id < b.id;
+}
+
+static std::string roles_string(const std::vector<aegis::snowflake> &roles)
+{
+	std::string roles_str;
+	for (auto n = roles.begin(); n != roles.end(); ++n) {
+		roles_str.append(std::to_string(n->get())).append(",");
+	}
+	return roles_str.substr(0, roles_str.length() - 1);
+}
+
+static uint64_t membership_hash(const std::string &nick, const std::string &roles_str, const std::string &dashboard)
+{
+	return std::hash<std::string>()(nick + '\0' + roles_str + '\0' + dashboard);
+}
+
+static uint64_t user_hash(const aegis::gateway::objects::user &u)
+{
+	return std::hash<std::string>()(u.username + '\0' + u.discriminator + '\0' + u.avatar + '\0' + (u.is_bot() ? 'b' : 'u'));
+}
 
 /**
  * Provides caching of users, guilds and memberships to an sql database for use by external programs.
+ *
+ * A guild is sent again in full every time a shard reconnects, so the module remembers a
+ * fingerprint of what it last wrote for each guild and only writes the members and channels
+ * which have changed since. The fingerprints are only held in memory, so after a restart or a
+ * reload every guild is written in full once.
  */
 
 class SQLCacheModule : public Module
@@ -40,77 +118,312 @@ class SQLCacheModule : public Module
 	std::mutex user_cache_mutex;
 	std::mutex guild_cache_mutex;
 
+	/* Signalled when users are queued, when there is room in the user queue, and when guilds are queued */
+	std::condition_variable user_ready;
+	std::condition_variable user_space;
+	std::condition_variable guild_ready;
+
 	/* True if the thread is to terminate */
-	bool terminate;
+	std::atomic<bool> terminate;
 
-	/* Userqueue: a queue of users waiting to be written to SQL for the dashboard */
-	std::queue<aegis::gateway::objects::user> userqueue;
+	/* Userqueue: users waiting to be written to SQL for the dashboard, at most once each. The
+	 * ids are kept in the order they were first queued, and the map holds the latest details
+	 * queued for each id, so a user seen in many guilds is only written once.
+	 */
+	std::deque<int64_t> userqueue;
+	std::unordered_map<int64_t, aegis::gateway::objects::user> pending_users;
 	std::queue<aegis::gateway::objects::guild> guildqueue;
+
+	/* Guild id to what was last written for it, protected by fingerprint_mutex */
+	std::unordered_map<int64_t, guild_fingerprint> fingerprints;
+	std::mutex fingerprint_mutex;
+
+	/* Record a single member as written, e.g. when they join */
+	void SetMemberFingerprint(int64_t guild_id, const member_fingerprint &m) {
+		std::lock_guard<std::mutex> fingerprint_lock(fingerprint_mutex);
+		auto g = fingerprints.find(guild_id);
+		if (g == fingerprints.end()) {
+			/* Not seen the whole guild yet, it will be written in full when we do */
+			return;
+		}
+		auto i = std::lower_bound(g->second.members.begin(), g->second.members.end(), m, fingerprint_less);
+		if (i != g->second.members.end() && i->id == m.id) {
+			*i = m;
+		} else {
+			g->second.members.insert(i, m);
+		}
+	}
+
+	/* Forget that a user was written, in every guild, so the next resend of any of them queues the user again */
+	void ForgetUserFingerprint(int64_t user_id) {
+		std::lock_guard<std::mutex> fingerprint_lock(fingerprint_mutex);
+		member_fingerprint m = { user_id, 0, 0 };
+		for (auto g = fingerprints.begin(); g != fingerprints.end(); ++g) {
+			auto i = std::lower_bound(g->second.members.begin(), g->second.members.end(), m, fingerprint_less);
+			if (i != g->second.members.end() && i->id == user_id) {
+				i->user = 0;
+			}
+		}
+	}
+
+	void RemoveMemberFingerprint(int64_t guild_id, int64_t member_id) {
+		std::lock_guard<std::mutex> fingerprint_lock(fingerprint_mutex);
+		auto g = fingerprints.find(guild_id);
+		if (g != fingerprints.end()) {
+			member_fingerprint m = { member_id, 0, 0 };
+			auto i = std::lower_bound(g->second.members.begin(), g->second.members.end(), m, fingerprint_less);
+			if (i != g->second.members.end() && i->id == member_id) {
+				g->second.members.erase(i);
+			}
+		}
+	}
+
+	/**
+	 * Swap in the new fingerprint of a guild, and return the previous one, which is empty if
+	 * the guild hasn't been seen since the module was loaded.
+	 */
+	guild_fingerprint ExchangeFingerprint(int64_t guild_id, guild_fingerprint &current) {
+		std::lock_guard<std::mutex> fingerprint_lock(fingerprint_mutex);
+		guild_fingerprint previous;
+		auto g = fingerprints.find(guild_id);
+		if (g != fingerprints.end()) {
+			previous = std::move(g->second);
+			g->second = std::move(current);
+		} else {
+			fingerprints.emplace(guild_id, std::move(current));
+		}
+		return previous;
+	}
+
 public:
 
+	/**
+	 * Write a batch of users as one multi-row upsert. A single statement is applied atomically
+	 * by InnoDB, so this gets the benefit of a transaction without holding one open across the
+	 * shared database connection, which other threads are using in between our queries.
+	 */
+	bool SaveUsers(const std::vector<aegis::gateway::objects::user> &users, size_t first, size_t last) {
+		std::string values;
+		db::paramlist params;
+		params.reserve((last - first) * 5);
+		for (auto u = users.begin() + first; u != users.begin() + last; ++u) {
+			values.append(values.empty() ? "(?, '?', '?', '?', ?)" : ",(?, '?', '?', '?', ?)");
+			params.emplace_back(u->id.get());
+			params.emplace_back(u->username);
+			params.emplace_back(u->discriminator);
+			params.emplace_back(u->avatar);
+			params.emplace_back(u->is_bot());
+		}
+		return db::execute("INSERT INTO infobot_discord_user_cache (id, username, discriminator, avatar, bot) VALUES " + values + " ON DUPLICATE KEY UPDATE username = VALUES(username), discriminator = VALUES(discriminator), avatar = VALUES(avatar)", params);
+	}
+
+	/**
+	 * Write users[first, last). If the server rejects the statement, the range is split in half
+	 * and each half tried again, so one bad row only loses itself rather than the whole batch.
+	 * A row rejected on its own is dropped, and its fingerprints forgotten so a later resend of
+	 * any of its guilds tries it again. Returns false, without splitting, on a transient error.
+	 */
+	bool SaveUserRange(const std::vector<aegis::gateway::objects::user> &users, size_t first, size_t last) {
+		if (SaveUsers(users, first, last)) {
+			return true;
+		}
+		if (db::transient_error()) {
+			return false;
+		}
+		if (last - first == 1) {
+			bot->core.log->error("Can't write user {} to cache: {}", users[first].id.get(), db::error());
+			ForgetUserFingerprint(users[first].id.get());
+			return true;
+		}
+		size_t middle = first + (last - first) / 2;
+		return SaveUserRange(users, first, middle) && SaveUserRange(users, middle, last);
+	}
+
+	/**
+	 * Put a batch which couldn't be written back on the queue. Users queued again since they
+	 * were taken already have newer details waiting, and keep them.
+	 */
+	void RequeueUsers(std::vector<aegis::gateway::objects::user> &users) {
+		std::lock_guard<std::mutex> user_cache_lock(user_cache_mutex);
+		for (auto u = users.begin(); u != users.end(); ++u) {
+			if (pending_users.emplace(u->id.get(), std::move(*u)).second) {
+				userqueue.push_back(u->id.get());
+			}
+		}
+		bot->counters.Set("userqueue", userqueue.size());
+	}
+
+	/**
+	 * Drain the user queue a batch at a time. The batch size doubles while statements finish
+	 * well inside user_batch_target_ms and halves when they take longer, so a backlog clears as
+	 * fast as the database allows without any one statement holding the connection for long.
+	 */
 	void SaveCachedUsersThread() {
 		time_t last_message = time(NULL);
-		aegis::gateway::objects::user u;
+		time_t rate_start = time(NULL);
+		uint64_t rate_rows = 0;
+		size_t batch_size = user_batch_start;
+		std::vector<aegis::gateway::objects::user> batch;
+		batch.reserve(user_batch_max);
 		while (!this->terminate) {
-			if (!userqueue.empty()) {
-				{
-					std::lock_guard<std::mutex> user_cache_lock(user_cache_mutex);
-					u = userqueue.front();
-					userqueue.pop();
-					bot->counters["userqueue"] = userqueue.size();
-				};
-				std::string bot = u.is_bot() ? "1" : "0";
-				db::query("INSERT INTO infobot_discord_user_cache (id, username, discriminator, avatar, bot) VALUES(?, '?', '?', '?', ?) ON DUPLICATE KEY UPDATE username = '?', discriminator = '?', avatar = '?'", {u.id.get(), u.username, u.discriminator, u.avatar, bot, u.username, u.discriminator, u.avatar});
-				std::this_thread::sleep_for(std::chrono::milliseconds(1));
-			} else {
-				std::this_thread::sleep_for(std::chrono::seconds(1));
+			batch.clear();
+			size_t remaining;
+			{
+				std::unique_lock<std::mutex> user_cache_lock(user_cache_mutex);
+				user_ready.wait_for(user_cache_lock, queue_idle_wait, [this]() { return !userqueue.empty() || terminate; });
+				while (!userqueue.empty() && batch.size() < batch_size) {
+					auto u = pending_users.find(userqueue.front());
+					batch.emplace_back(std::move(u->second));
+					pending_users.erase(u);
+					userqueue.pop_front();
+				}
+				remaining = userqueue.size();
+				bot->counters.Set("userqueue", remaining);
+			}
+			if (!batch.empty()) {
+				user_space.notify_all();
+			}
+			if (!batch.empty()) {
+				auto start = std::chrono::steady_clock::now();
+				if (!SaveUserRange(batch, 0, batch.size())) {
+					bot->core.log->warn("Can't write {} users to cache, will retry: {}", batch.size(), db::error());
+					RequeueUsers(batch);
+					std::this_thread::sleep_for(queue_idle_wait);
+					continue;
+				}
+				double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+				if (ms > user_batch_target_ms) {
+					batch_size = std::max(user_batch_min, batch_size / 2);
+				} else if (ms < user_batch_target_ms / 2 && batch.size() == batch_size) {
+					batch_size = std::min(user_batch_max, batch_size * 2);
+				}
+				rate_rows += batch.size();
+			}
+			if (time(NULL) - rate_start >= user_rate_window) {
+				bot->counters.Set("userqueue_rate", rate_rows / (time(NULL) - rate_start));
+				rate_start = time(NULL);
+				rate_rows = 0;
 			}
 			if (time(NULL) > last_message) {
-				if (userqueue.size() > 0) {
-					bot->core.log->info("User queue size: {} objects", userqueue.size());
+				if (remaining > 0) {
+					bot->core.log->info("User queue size: {} objects, writing {} rows/sec in batches of {}", remaining, bot->counters.Get("userqueue_rate"), batch_size);
 				}
 				last_message = time(NULL) + 60;
 			}
 		}
 	}
 
+	/**
+	 * Queue a user to be written. If they are already waiting, their details are updated in
+	 * place and keep their position. Otherwise this waits while the queue is full. Only the
+	 * guild thread calls this, so the wait slows down the guild thread rather than the gateway.
+	 */
+	void QueueUser(const aegis::gateway::objects::user &u) {
+		int64_t id = u.id.get();
+		{
+			std::unique_lock<std::mutex> user_cache_lock(user_cache_mutex);
+			auto existing = pending_users.find(id);
+			if (existing != pending_users.end()) {
+				existing->second = u;
+				bot->counters.Add("userqueue_merged", 1);
+				return;
+			}
+			user_space.wait(user_cache_lock, [this]() { return userqueue.size() < user_queue_limit || terminate; });
+			if (terminate) {
+				return;
+			}
+			pending_users.emplace(id, u);
+			userqueue.push_back(id);
+			bot->counters.Set("userqueue", userqueue.size());
+		}
+		user_ready.notify_one();
+	}
+
+	/**
+	 * Write the channels and members of a guild which differ from its previous fingerprint.
+	 * Members no longer in the guild are left alone, as without the member intent the member
+	 * list of a large guild is incomplete. Their rows are removed by OnGuildMemberRemove.
+	 */
+	void SyncGuild(const aegis::gateway::objects::guild &gc) {
+		int64_t guild_id = gc.id.get();
+		guild_fingerprint current;
+		current.members.reserve(gc.members.size());
+		for (auto i = gc.channels.begin(); i != gc.channels.end(); ++i) {
+			current.channels[i->id.get()] = std::hash<std::string>()(i->name + '\0' + std::to_string(i->parent_id.get()));
+		}
+		for (auto i = gc.members.begin(); i != gc.members.end(); ++i) {
+			std::string dashboard = (gc.owner_id == i->_user.id ? "1" : "0");
+			current.members.push_back({ i->_user.id.get(), membership_hash(i->nick, roles_string(i->roles), dashboard), user_hash(i->_user) });
+		}
+		std::sort(current.members.begin(), current.members.end(), fingerprint_less);
+
+		/* Keep a copy, the original is moved into the fingerprint map */
+		guild_fingerprint now = current;
+		guild_fingerprint previous = ExchangeFingerprint(guild_id, current);
+
+		uint64_t channels_written = 0, members_written = 0, users_queued = 0;
+		bool ok = true;
+		for (auto i = gc.channels.begin(); i != gc.channels.end(); ++i) {
+			auto p = previous.channels.find(i->id.get());
+			if (p == previous.channels.end() || p->second != now.channels[i->id.get()]) {
+				getSettings(bot, i->id.get(), guild_id);
+				channels_written++;
+			}
+		}
+		for (auto i = gc.members.begin(); i != gc.members.end() && !terminate; ++i) {
+			member_fingerprint key = { i->_user.id.get(), 0, 0 };
+			auto n = std::lower_bound(now.members.begin(), now.members.end(), key, fingerprint_less);
+			auto p = std::lower_bound(previous.members.begin(), previous.members.end(), key, fingerprint_less);
+			bool seen = (p != previous.members.end() && p->id == key.id);
+			if (!seen || p->user != n->user) {
+				QueueUser(i->_user);
+				users_queued++;
+			}
+			if (!seen || p->membership != n->membership) {
+				std::string roles_str = roles_string(i->roles);
+				std::string dashboard = "0";
+				if (gc.owner_id == i->_user.id) {
+					/* Server owner */
+					dashboard = "1";
+				}
+				ok = db::execute("INSERT INTO infobot_membership (member_id, guild_id, nick, roles, dashboard) VALUES(?, ?, '?', '?','?') ON DUPLICATE KEY UPDATE nick = '?', roles = '?', dashboard = '?'", {i->_user.id.get(), guild_id, i->nick, roles_str, dashboard, i->nick, roles_str, dashboard}) && ok;
+				members_written++;
+			}
+		}
+		if (!ok || terminate) {
+			/* Some rows weren't written, so don't trust the fingerprint next time */
+			std::lock_guard<std::mutex> fingerprint_lock(fingerprint_mutex);
+			fingerprints.erase(guild_id);
+		}
+		bot->core.log->debug("Guild {} synced to cache: {}/{} channels, {}/{} members and {} users written", guild_id, channels_written, gc.channels.size(), members_written, gc.members.size(), users_queued);
+	}
+
 	void SaveCachedGuildsThread() {
 		time_t last_message = time(NULL);
 		aegis::gateway::objects::guild gc;
 		while (!this->terminate) {
-			if (!guildqueue.empty()) {
-				{
-					std::lock_guard<std::mutex> user_cache_lock(guild_cache_mutex);
-					gc = guildqueue.front();
+			bool have_guild = false;
+			size_t remaining;
+			{
+				std::unique_lock<std::mutex> guild_cache_lock(guild_cache_mutex);
+				guild_ready.wait_for(guild_cache_lock, queue_idle_wait, [this]() { return !guildqueue.empty() || terminate; });
+				if (!guildqueue.empty() && !terminate) {
+					gc = std::move(guildqueue.front());
 					guildqueue.pop();
-					bot->counters["guildqueue"] = guildqueue.size();
-				};
-				for (auto i = gc.channels.begin(); i != gc.channels.end(); ++i) {
-					getSettings(bot, i->id.get(), gc.id.get());
-				}
-				for (auto i = gc.members.begin(); i != gc.members.end(); ++i) {
-					std::lock_guard<std::mutex> user_cache_lock(user_cache_mutex);
-					userqueue.push(i->_user);
-					bot->counters["userqueue"] = userqueue.size();
-					std::string roles_str;
-					for (auto n = i->roles.begin(); n != i->roles.end(); ++n) {
-						roles_str.append(std::to_string(n->get())).append(",");
-					}
-					roles_str = roles_str.substr(0, roles_str.length() - 1);
-					std::string dashboard = "0";
-					if (gc.owner_id == i->_user.id) {
-						/* Server owner */
-						dashboard = "1";
-					}
-					db::query("INSERT INTO infobot_membership (member_id, guild_id, nick, roles, dashboard) VALUES(?, ?, '?', '?','?') ON DUPLICATE KEY UPDATE nick = '?', roles = '?', dashboard = '?'", {i->_user.id.get(), gc.id.get(), i->nick, roles_str, dashboard, i->nick, roles_str, dashboard});
+					have_guild = true;
 				}
-				std::this_thread::sleep_for(std::chrono::milliseconds(1));
-			} else {
-				std::this_thread::sleep_for(std::chrono::seconds(1));
+				remaining = guildqueue.size();
+				bot->counters.Set("guildqueue", remaining);
+			}
+			if (have_guild) {
+				SyncGuild(gc);
 			}
 			if (time(NULL) > last_message) {
-				if (guildqueue.size() > 0) {
-					bot->core.log->info("User guild size: {} objects", guildqueue.size());
+				if (remaining > 0) {
+					bot->core.log->info("User guild size: {} objects", remaining);
+				}
+				if (bot->counters.Get("guildqueue_dropped") > 0) {
+					bot->core.log->warn("Guild queue was full, {} guilds not cached so far", bot->counters.Get("guildqueue_dropped"));
 				}
 				last_message = time(NULL) + 60;
 			}
@@ -120,24 +433,37 @@ public:
 	SQLCacheModule(Bot* instigator, ModuleLoader* ml) : Module(instigator, ml), thr_userqueue(nullptr), thr_guildqueue(nullptr), terminate(false)
 	{
 		ml->Attach({ I_OnGuildCreate, I_OnPresenceUpdate, I_OnGuildMemberAdd, I_OnChannelCreate, I_OnChannelDelete, I_OnGuildDelete, I_OnGuildMemberRemove }, this);
-		bot->counters["userqueue"] = 0;
+		bot->counters.Set("userqueue", 0);
+		bot->counters.Set("userqueue_rate", 0);
+		bot->counters.Set("userqueue_merged", 0);
+		bot->counters.Set("guildqueue", 0);
+		bot->counters.Set("guildqueue_dropped", 0);
 		thr_userqueue = new std::thread(&SQLCacheModule::SaveCachedUsersThread, this);
 		thr_guildqueue = new std::thread(&SQLCacheModule::SaveCachedGuildsThread, this);
 	}
 
 	virtual ~SQLCacheModule()
 	{
-		terminate = true;
+		{
+			/* Set under both locks so that no thread can miss the wakeup between checking and waiting */
+			std::lock_guard<std::mutex> user_cache_lock(user_cache_mutex);
+			std::lock_guard<std::mutex> guild_cache_lock(guild_cache_mutex);
+			terminate = true;
+		}
+		user_ready.notify_all();
+		user_space.notify_all();
+		guild_ready.notify_all();
 		bot->DisposeThread(thr_userqueue);
 		bot->DisposeThread(thr_guildqueue);
-		bot->counters["userqueue"] = 0;
-		bot->counters["guildqueue"] = 0;
+		bot->counters.Set("userqueue", 0);
+		bot->counters.Set("guildqueue", 0);
+		bot->counters.Set("userqueue_rate", 0);
 	}
 
 	virtual std::string GetVersion()
 	{
 		/* NOTE: This version string below is modified by a pre-commit hook on the git repository */
-		std::string version = "$ModVer 8$";
+		std::string version = "$ModVer 15$";
 		return "1.0." + version.substr(8,version.length() - 9);
 	}
 
@@ -166,9 +492,14 @@ public:
 
 		{
 			std::lock_guard<std::mutex> guild_cache_lock(guild_cache_mutex);
+			if (guildqueue.size() >= guild_queue_limit) {
+				bot->counters.Add("guildqueue_dropped", 1);
+				return true;
+			}
 			guildqueue.push(gc.guild);
-			bot->counters["guildqueue"] = guildqueue.size();
+			bot->counters.Set("guildqueue", guildqueue.size());
 		}
+		guild_ready.notify_one();
 
 		return true;
 	}
@@ -200,19 +531,16 @@ public:
 
 	virtual bool OnGuildMemberRemove(const modevent::guild_member_remove &gmr)
 	{
-		db::query("DELETE FROM infobot_membership WHERE member_id = '?'", {gmr.user.id.get()});
+		db::query("DELETE FROM infobot_membership WHERE member_id = '?' AND guild_id = '?'", {gmr.user.id.get(), gmr.guild_id.get()});
+		RemoveMemberFingerprint(gmr.guild_id.get(), gmr.user.id.get());
 		return true;
 	}
 
 	virtual bool OnGuildMemberAdd(const modevent::guild_member_add &gma)
 	{
 		bool _bot = gma.member._user.is_bot();
-		std::string roles_str;
+		std::string roles_str = roles_string(gma.member.roles);
 		aegis::guild* g = bot->core.find_guild(gma.member.guild_id.get());
-		for (auto n = gma.member.roles.begin(); n != gma.member.roles.end(); ++n) {
-			roles_str.append(std::to_string(n->get())).append(",");
-		}
-		roles_str = roles_str.substr(0, roles_str.length() - 1);
 		std::string dashboard = "0";
 		if (g->get_owner() == gma.member._user.id) {
 			/* Server owner */
@@ -220,6 +548,7 @@ public:
 		}		
 		db::query("INSERT INTO infobot_discord_user_cache (id, username, discriminator, avatar, bot) VALUES(?, '?', '?', '?', ?) ON DUPLICATE KEY UPDATE username = '?', discriminator = '?', avatar = '?'", {gma.member._user.id.get(), gma.member._user.username, gma.member._user.discriminator, gma.member._user.avatar, _bot, gma.member._user.username, gma.member._user.discriminator, gma.member._user.avatar});
 		db::query("INSERT INTO infobot_membership (member_id, guild_id, nick, roles, dashboard) VALUES(?, ?, '?', '?','?') ON DUPLICATE KEY UPDATE nick = '?', roles = '?', dashboard = '?'", {gma.member._user.id.get(), gma.member.guild_id.get(), gma.member.nick, roles_str, dashboard, gma.member.nick, roles_str, dashboard});
+		SetMemberFingerprint(gma.member.guild_id.get(), { gma.member._user.id.get(), membership_hash(gma.member.nick, roles_str, dashboard), user_hash(gma.member._user) });
 		return true;
 	}
 
@@ -232,6 +561,13 @@ public:
 	virtual bool OnChannelDelete(const modevent::channel_delete cd)
 	{
 		db::query("DELETE FROM infobot_discord_settings WHERE id = '?'", {cd.channel.id.get()});
+		{
+			std::lock_guard<std::mutex> fingerprint_lock(fingerprint_mutex);
+			auto g = fingerprints.find(cd.channel.guild_id.get());
+			if (g != fingerprints.end()) {
+				g->second.channels.erase(cd.channel.id.get());
+			}
+		}
 		return true;
 	}
 
@@ -240,6 +576,10 @@ public:
 		db::query("DELETE FROM infobot_discord_settings WHERE guild_id = '?'", {gd.guild_id.get()});
 		db::query("DELETE FROM infobot_shard_map WHERE guild_id = '?'", {gd.guild_id.get()});
 		db::query("DELETE FROM infobot_membership WHERE guild_id = '?'", {gd.guild_id.get()});
+		{
+			std::lock_guard<std::mutex> fingerprint_lock(fingerprint_mutex);
+			fingerprints.erase(gd.guild_id.get());
+		}
 		return true;
 	}
 };
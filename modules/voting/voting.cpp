@@ -22,6 +22,8 @@
 #include <sporks/modules.h>
 #include <string>
 #include <cstdint>
+#include <algorithm>
+#include <unordered_map>
 #include <fstream>
 #include <streambuf>
 #include <sporks/stringops.h>
@@ -46,7 +48,7 @@ public:
 	virtual std::string GetVersion()
 	{
 		/* NOTE: This version string below is modified by a pre-commit hook on the git repository */
-		std::string version = "$ModVer 5$";
+		std::string version = "$ModVer 7$";
 		return "1.0." + version.substr(8,version.length() - 9);
 	}
 
@@ -57,7 +59,20 @@ public:
 
 	virtual bool OnPresenceUpdate()
 	{
-		db::resultset rs_votes = db::query("SELECT id, snowflake_id, UNIX_TIMESTAMP(vote_time) AS vote_time, origin, rolegiven FROM infobot_votes", {});
+		db::resultset rs_votes;
+		bool loaded = db::query("SELECT id, snowflake_id, UNIX_TIMESTAMP(vote_time) AS vote_time, origin, rolegiven FROM infobot_votes", {}, rs_votes);
+
+		/* Refresh the voter index from the same result. A user may have several votes, the latest counts. */
+		if (loaded) {
+			std::unordered_map<int64_t, time_t> voters;
+			for (auto vote = rs_votes.begin(); vote != rs_votes.end(); ++vote) {
+				time_t expiry = from_string<time_t>((*vote)["vote_time"], std::dec) + vote_duration;
+				time_t &v = voters[from_string<int64_t>((*vote)["snowflake_id"], std::dec)];
+				v = std::max(v, expiry);
+			}
+			bot->voters.Replace(voters);
+		}
+
 		aegis::guild* home = bot->core.find_guild(from_string<int64_t>(Bot::GetConfig("home"), std::dec));
 		if (home) {
 			/* Process removals first */
@@ -70,7 +85,7 @@ public:
 						 * Votes last 24 hours.
 						 */
 						uint64_t role_timestamp = from_string<uint64_t>((*vote)["vote_time"], std::dec);
-						if (time(NULL) - role_timestamp > 86400) {
+						if (time(NULL) - role_timestamp > vote_duration) {
 							db::query("DELETE FROM infobot_votes WHERE id = ?", {(*vote)["id"]});
 							home->remove_guild_member_role(member_id, from_string<int64_t>(Bot::GetConfig("vote_role"), std::dec));
 							bot->core.log->info("Removing vanity role from {}", member_id);
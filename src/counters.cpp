@@ -0,0 +1,46 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <sporks/counters.h>
+
+void Counters::Set(const std::string &name, uint64_t value)
+{
+	std::lock_guard<std::mutex> counters_lock(counters_mutex);
+	values[name] = value;
+}
+
+uint64_t Counters::Add(const std::string &name, uint64_t value)
+{
+	std::lock_guard<std::mutex> counters_lock(counters_mutex);
+	return values[name] += value;
+}
+
+uint64_t Counters::Get(const std::string &name)
+{
+	std::lock_guard<std::mutex> counters_lock(counters_mutex);
+	auto i = values.find(name);
+	return i == values.end() ? 0 : i->second;
+}
+
+bool Counters::Has(const std::string &name)
+{
+	std::lock_guard<std::mutex> counters_lock(counters_mutex);
+	return values.find(name) != values.end();
+}
@@ -28,7 +28,14 @@ namespace db {
 
 	MYSQL connection;
 	std::mutex db_mutex;
-	std::string _error;
+	/* Per thread, as the connection is shared and another thread's query would otherwise overwrite it */
+	thread_local std::string _error;
+	thread_local unsigned int _errno = 0;
+
+	/* Client side errors (lost connection and the like) are numbered from here up */
+	const unsigned int client_error_min = 2000;
+	const unsigned int er_lock_wait_timeout = 1205;
+	const unsigned int er_lock_deadlock = 1213;
 
 	/**
 	 * Connect to mysql database, returns false if there was an error.
@@ -63,50 +70,54 @@ namespace db {
 		return _error;
 	}
 
+	bool transient_error() {
+		return _errno >= client_error_min || _errno == er_lock_wait_timeout || _errno == er_lock_deadlock;
+	}
+
 	/**
-	 * Run a mysql query, with automatic escaping of parameters to prevent SQL injection.
-	 * The parameters given should be a vector of strings. You can instantiate this using "{}".
-	 * For example: db::query("UPDATE foo SET bar = '?' WHERE id = '?'", {"baz", "3"});
-	 * Returns a resultset of the results as rows. Avoid returning massive resultsets if you can.
+	 * Escape all parameters and substitute them into the query format, returning the
+	 * finished query string. Caller must hold db_mutex, as escaping uses the connection.
+	 * Returns false and sets _error if any parameter could not be escaped.
 	 */
-	resultset query(const std::string &format, const paramlist &parameters) {
-
-		/**
-		 * One DB handle can't query the database from multiple threads at the same time.
-		 * To prevent corruption of results, put a lock guard on queries.
-		 */
-		std::lock_guard<std::mutex> db_lock(db_mutex);
+	static bool build_query(const std::string &format, const paramlist &parameters, std::string &querystring) {
 
 		std::vector<std::string> escaped_parameters;
+		escaped_parameters.reserve(parameters.size());
 
-		resultset rv;
+		/* Reused between parameters; worst case scenario every character becomes two, plus NULL terminator */
+		std::vector<char> out;
 
 		/**
 		 * Escape all parameters properly from a vector of std::variant
 		 */
 		for (const auto& param : parameters) {
-			/* Worst case scenario: Every character becomes two, plus NULL terminator*/
-			std::visit([parameters, &escaped_parameters](const auto &p) {
+			std::visit([&out, &escaped_parameters](const auto &p) {
 				std::ostringstream v;
 				v << p;
 				std::string s_param(v.str());
-				char out[s_param.length() * 2 + 1];
+				out.resize(s_param.length() * 2 + 1);
 				/* Some moron thought it was a great idea for mysql_real_escape_string to return an unsigned but use -1 to indicate error.
 				 * This stupid cast below is the actual recommended error check from the reference manual. Seriously stupid.
 				 */
-				if (mysql_real_escape_string(&connection, out, s_param.c_str(), s_param.length()) != (unsigned long)-1) {
-					escaped_parameters.push_back(out);
+				unsigned long length = mysql_real_escape_string(&connection, out.data(), s_param.c_str(), s_param.length());
+				if (length != (unsigned long)-1) {
+					escaped_parameters.emplace_back(out.data(), length);
 				}
 			}, param);
 		}
 
 		if (parameters.size() != escaped_parameters.size()) {
 			_error = "Parameter wasn't escaped; error: " + std::string(mysql_error(&connection));
-			return rv;
+			return false;
 		}
 
 		unsigned int param = 0;
-		std::string querystring;
+		size_t total = format.length();
+		for (const auto& e : escaped_parameters) {
+			total += e.length();
+		}
+		querystring.clear();
+		querystring.reserve(total);
 
 		/**
 		 * Search and replace escaped parameters in the query string.
@@ -124,8 +135,69 @@ namespace db {
 				querystring += *v;
 			}
 		}
+		return true;
+	}
+
+	/**
+	 * Run a mysql query, with automatic escaping of parameters to prevent SQL injection.
+	 * The parameters given should be a vector of strings. You can instantiate this using "{}".
+	 * For example: db::query("UPDATE foo SET bar = '?' WHERE id = '?'", {"baz", "3"});
+	 * Returns a resultset of the results as rows. Avoid returning massive resultsets if you can.
+	 */
+	resultset query(const std::string &format, const paramlist &parameters) {
+		resultset rv;
+		query(format, parameters, rv);
+		return rv;
+	}
+
+	/**
+	 * Run a mysql query as above, returning whether it succeeded. Check this rather than
+	 * inferring failure from an empty resultset.
+	 */
+	bool query(const std::string &format, const paramlist &parameters, resultset &results) {
+		results.clear();
+		return query_each(format, parameters, [&results](const row &thisrow) {
+			results.push_back(thisrow);
+			return true;
+		});
+	}
+
+	/**
+	 * Run a mysql query for its effect, e.g. an INSERT or UPDATE. Returns false if it failed.
+	 */
+	bool execute(const std::string &format, const paramlist &parameters) {
+		return query_each(format, parameters, [](const row &thisrow) {
+			return true;
+		});
+	}
+
+	/**
+	 * Run a mysql query as above, but hand each row to a callback as it arrives from the server
+	 * instead of building a resultset. Rows are read with mysql_use_result(), so a query over
+	 * millions of rows never holds more than one of them in memory. The database lock is held
+	 * until the last row has been read, so keep the callback quick. Returning false from the
+	 * callback stops early; any remaining rows are discarded.
+	 * Returns false if the query failed.
+	 */
+	bool query_each(const std::string &format, const paramlist &parameters, const row_callback &callback) {
+
+		/**
+		 * One DB handle can't query the database from multiple threads at the same time.
+		 * To prevent corruption of results, put a lock guard on queries.
+		 */
+		std::lock_guard<std::mutex> db_lock(db_mutex);
+
+		_error.clear();
+		_errno = 0;
+
+		std::string querystring;
+		if (!build_query(format, parameters, querystring)) {
+			/* Escaping only fails if the connection is in a bad way */
+			_errno = mysql_errno(&connection) ? mysql_errno(&connection) : client_error_min;
+			return false;
+		}
 
-		int result = mysql_query(&connection, querystring.c_str());
+		int result = mysql_real_query(&connection, querystring.c_str(), querystring.length());
 
 		/**
 		 * On successful query collate results into a std::map
@@ -134,32 +206,31 @@ namespace db {
 			MYSQL_RES *a_res = mysql_use_result(&connection);
 			if (a_res) {
 				MYSQL_ROW a_row;
-				while ((a_row = mysql_fetch_row(a_res))) {
-					MYSQL_FIELD *fields = mysql_fetch_fields(a_res);
+				MYSQL_FIELD *fields = mysql_fetch_fields(a_res);
+				unsigned int num_fields = mysql_num_fields(a_res);
+				bool wanted = true;
+				while (wanted && fields && num_fields && (a_row = mysql_fetch_row(a_res))) {
+					unsigned long *lengths = mysql_fetch_lengths(a_res);
 					row thisrow;
-					unsigned int field_count = 0;
-					if (mysql_num_fields(a_res) == 0) {
-						break;
-					}
-					if (fields && mysql_num_fields(a_res)) {
-						while (field_count < mysql_num_fields(a_res)) {
-							std::string a = (fields[field_count].name ? fields[field_count].name : "");
-							std::string b = (a_row[field_count] ? a_row[field_count] : "");
-							thisrow[a] = b;
-							field_count++;
-						}
-						rv.push_back(thisrow);
+					for (unsigned int field_count = 0; field_count < num_fields; ++field_count) {
+						std::string a = (fields[field_count].name ? fields[field_count].name : "");
+						std::string b = (a_row[field_count] ? std::string(a_row[field_count], lengths[field_count]) : "");
+						thisrow[a] = b;
 					}
+					wanted = callback(thisrow);
 				}
+				/* For an unbuffered result this also reads and discards any rows we didn't want */
 				mysql_free_result(a_res);
 			}
+			return true;
 		} else {
 			/**
 			 * In properly written code, this should never happen. Famous last words.
 			 */
 			_error = mysql_error(&connection);
+			_errno = mysql_errno(&connection);
 			std::cerr << "SQL error: " << _error << " on query: " << querystring << std::endl;
+			return false;
 		}
-		return rv;
 	}
 };
@@ -85,6 +85,7 @@ void Bot::onResumed (aegis::gateway::events::resumed obj)
 
 void Bot::onChannelUpdate (aegis::gateway::events::channel_update obj)
 {
+	names.AddChannel(obj.channel.guild_id.get(), obj.channel.id.get(), obj.channel.name);
 	FOREACH_MOD(I_OnChannelUpdate, OnChannelUpdate(obj));
 }
 
@@ -121,18 +122,23 @@ void Bot::onGuildIntegrationsUpdate (aegis::gateway::events::guild_integrations_
 
 void Bot::onGuildMemberRemove (aegis::gateway::events::guild_member_remove obj)
 {
+	names.RemoveMember(obj.guild_id.get(), obj.user.id.get());
 	FOREACH_MOD(I_OnGuildMemberRemove, OnGuildMemberRemove(obj));
 }
 
 
 void Bot::onGuildMemberUpdate (aegis::gateway::events::guild_member_update obj)
 {
+	names.AddMember(obj.guild_id.get(), obj.user.id.get(), obj.user.username, obj.user.discriminator);
 	FOREACH_MOD(I_OnGuildMemberUpdate, OnGuildMemberUpdate(obj));
 }
 
 
 void Bot::onGuildMembersChunk (aegis::gateway::events::guild_members_chunk obj)
 {
+	for (auto i = obj.members.begin(); i != obj.members.end(); ++i) {
+		names.AddMember(obj.guild_id.get(), i->_user.id.get(), i->_user.username, i->_user.discriminator);
+	}
 	FOREACH_MOD(I_OnGuildMembersChunk, OnGuildMembersChunk(obj));
 }
 
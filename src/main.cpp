@@ -107,6 +107,17 @@ bool Bot::HasMemberIntents() {
  * SaveCachedUsersThread().
  */
 void Bot::onServer(aegis::gateway::events::guild_create gc) {
+	std::vector<std::tuple<int64_t, std::string, std::string>> members;
+	std::vector<std::pair<int64_t, std::string>> channels;
+	members.reserve(gc.guild.members.size());
+	channels.reserve(gc.guild.channels.size());
+	for (auto i = gc.guild.members.begin(); i != gc.guild.members.end(); ++i) {
+		members.emplace_back(i->_user.id.get(), i->_user.username, i->_user.discriminator);
+	}
+	for (auto i = gc.guild.channels.begin(); i != gc.guild.channels.end(); ++i) {
+		channels.emplace_back(i->id.get(), i->name);
+	}
+	names.AddGuild(gc.guild.id.get(), members, channels);
 	FOREACH_MOD(I_OnGuildCreate, OnGuildCreate(gc));
 }
 
@@ -126,6 +137,7 @@ void Bot::UpdatePresenceThread() {
  * Stores a new guild member to the database for use in the dashboard
  */
 void Bot::onMember(aegis::gateway::events::guild_member_add gma) {
+	names.AddMember(gma.member.guild_id.get(), gma.member._user.id.get(), gma.member._user.username, gma.member._user.discriminator);
 	FOREACH_MOD(I_OnGuildMemberAdd, OnGuildMemberAdd(gma));
 }
 
@@ -206,14 +218,17 @@ void Bot::onMessage(aegis::gateway::events::message_create message) {
 }
 
 void Bot::onChannel(aegis::gateway::events::channel_create channel_create) {
+	names.AddChannel(channel_create.channel.guild_id.get(), channel_create.channel.id.get(), channel_create.channel.name);
 	FOREACH_MOD(I_OnChannelCreate, OnChannelCreate(channel_create));
 }
 
 void Bot::onChannelDelete(aegis::gateway::events::channel_delete cd) {
+	names.RemoveChannel(cd.channel.guild_id.get(), cd.channel.id.get());
 	FOREACH_MOD(I_OnChannelDelete, OnChannelDelete(cd));
 }
 
 void Bot::onServerDelete(aegis::gateway::events::guild_delete gd) {
+	names.RemoveGuild(gd.guild_id.get());
 	FOREACH_MOD(I_OnGuildDelete, OnGuildDelete(gd));
 }
 
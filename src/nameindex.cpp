@@ -0,0 +1,194 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <functional>
+#include <sporks/nameindex.h>
+#include <sporks/stringops.h>
+
+uint64_t NameIndex::Hash(const std::string &name)
+{
+	return std::hash<std::string>()(lowercase(name));
+}
+
+void NameIndex::Unlink(std::unordered_multimap<uint64_t, int64_t> &map, uint64_t name, int64_t id)
+{
+	auto range = map.equal_range(name);
+	for (auto i = range.first; i != range.second; ++i) {
+		if (i->second == id) {
+			map.erase(i);
+			return;
+		}
+	}
+}
+
+bool NameIndex::Collect(const std::unordered_multimap<uint64_t, int64_t> &map, const std::string &name, std::vector<int64_t> &ids)
+{
+	auto range = map.equal_range(Hash(name));
+	for (auto i = range.first; i != range.second; ++i) {
+		ids.push_back(i->second);
+	}
+	return range.first != range.second;
+}
+
+void NameIndex::AddMemberLocked(guild_names &g, int64_t member_id, const std::string &username, const std::string &discriminator)
+{
+	uint64_t username_hash = Hash(username);
+	uint64_t full_name_hash = Hash(username + "#" + discriminator);
+	auto existing = g.members.find(member_id);
+	if (existing != g.members.end()) {
+		if (existing->second.full_name == full_name_hash) {
+			return;
+		}
+		Unlink(g.by_full_name, existing->second.full_name, member_id);
+		Unlink(g.by_username, existing->second.username, member_id);
+	}
+	g.by_full_name.emplace(full_name_hash, member_id);
+	g.by_username.emplace(username_hash, member_id);
+	g.members[member_id] = { full_name_hash, username_hash };
+}
+
+void NameIndex::AddChannelLocked(guild_names &g, int64_t channel_id, const std::string &name)
+{
+	uint64_t name_hash = Hash(name);
+	auto existing = g.channels.find(channel_id);
+	if (existing != g.channels.end()) {
+		if (existing->second == name_hash) {
+			return;
+		}
+		Unlink(g.by_channel_name, existing->second, channel_id);
+	}
+	g.by_channel_name.emplace(name_hash, channel_id);
+	g.channels[channel_id] = name_hash;
+}
+
+/**
+ * The guild is built outside the lock and swapped in whole, so a lookup never sees it half
+ * filled and other guilds aren't held up while a large one is indexed.
+ */
+void NameIndex::AddGuild(int64_t guild_id, const std::vector<std::tuple<int64_t, std::string, std::string>> &members, const std::vector<std::pair<int64_t, std::string>> &channels)
+{
+	guild_names g;
+	g.members.reserve(members.size());
+	g.by_full_name.reserve(members.size());
+	g.by_username.reserve(members.size());
+	for (auto & m : members) {
+		AddMemberLocked(g, std::get<0>(m), std::get<1>(m), std::get<2>(m));
+	}
+	for (auto & c : channels) {
+		AddChannelLocked(g, c.first, c.second);
+	}
+	std::lock_guard<std::mutex> names_lock(names_mutex);
+	guilds[guild_id] = std::move(g);
+}
+
+void NameIndex::RemoveGuild(int64_t guild_id)
+{
+	std::lock_guard<std::mutex> names_lock(names_mutex);
+	guilds.erase(guild_id);
+}
+
+/**
+ * Members and channels of a guild we haven't seen a guild create for are ignored, so that
+ * HasGuild() never claims a partial index is complete.
+ */
+void NameIndex::AddMember(int64_t guild_id, int64_t member_id, const std::string &username, const std::string &discriminator)
+{
+	std::lock_guard<std::mutex> names_lock(names_mutex);
+	auto g = guilds.find(guild_id);
+	if (g != guilds.end()) {
+		AddMemberLocked(g->second, member_id, username, discriminator);
+	}
+}
+
+void NameIndex::RemoveMember(int64_t guild_id, int64_t member_id)
+{
+	std::lock_guard<std::mutex> names_lock(names_mutex);
+	auto g = guilds.find(guild_id);
+	if (g == guilds.end()) {
+		return;
+	}
+	auto m = g->second.members.find(member_id);
+	if (m != g->second.members.end()) {
+		Unlink(g->second.by_full_name, m->second.full_name, member_id);
+		Unlink(g->second.by_username, m->second.username, member_id);
+		g->second.members.erase(m);
+	}
+}
+
+void NameIndex::AddChannel(int64_t guild_id, int64_t channel_id, const std::string &name)
+{
+	std::lock_guard<std::mutex> names_lock(names_mutex);
+	auto g = guilds.find(guild_id);
+	if (g != guilds.end()) {
+		AddChannelLocked(g->second, channel_id, name);
+	}
+}
+
+void NameIndex::RemoveChannel(int64_t guild_id, int64_t channel_id)
+{
+	std::lock_guard<std::mutex> names_lock(names_mutex);
+	auto g = guilds.find(guild_id);
+	if (g == guilds.end()) {
+		return;
+	}
+	auto c = g->second.channels.find(channel_id);
+	if (c != g->second.channels.end()) {
+		Unlink(g->second.by_channel_name, c->second, channel_id);
+		g->second.channels.erase(c);
+	}
+}
+
+bool NameIndex::HasGuild(int64_t guild_id)
+{
+	std::lock_guard<std::mutex> names_lock(names_mutex);
+	return guilds.find(guild_id) != guilds.end();
+}
+
+bool NameIndex::FindFullName(int64_t guild_id, const std::string &full_name, std::vector<int64_t> &ids)
+{
+	std::lock_guard<std::mutex> names_lock(names_mutex);
+	auto g = guilds.find(guild_id);
+	return g != guilds.end() && Collect(g->second.by_full_name, full_name, ids);
+}
+
+bool NameIndex::FindUsername(int64_t guild_id, const std::string &username, std::vector<int64_t> &ids)
+{
+	std::lock_guard<std::mutex> names_lock(names_mutex);
+	auto g = guilds.find(guild_id);
+	return g != guilds.end() && Collect(g->second.by_username, username, ids);
+}
+
+bool NameIndex::FindChannel(int64_t guild_id, const std::string &name, std::vector<int64_t> &ids)
+{
+	std::lock_guard<std::mutex> names_lock(names_mutex);
+	auto g = guilds.find(guild_id);
+	return g != guilds.end() && Collect(g->second.by_channel_name, name, ids);
+}
+
+void NameIndex::Counts(size_t &guild_count, size_t &member_count, size_t &channel_count)
+{
+	std::lock_guard<std::mutex> names_lock(names_mutex);
+	guild_count = guilds.size();
+	member_count = channel_count = 0;
+	for (auto & g : guilds) {
+		member_count += g.second.members.size();
+		channel_count += g.second.channels.size();
+	}
+}
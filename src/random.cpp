@@ -0,0 +1,106 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <sporks/random.h>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <functional>
+
+namespace rng {
+
+	/**
+	 * Generator state for xoshiro256**, see http://prng.di.unimi.it/
+	 */
+	struct xoshiro_state {
+		uint64_t s[4];
+		bool seeded = false;
+	};
+
+	thread_local xoshiro_state state;
+
+	static inline uint64_t rotl(const uint64_t x, int k) {
+		return (x << k) | (x >> (64 - k));
+	}
+
+	/**
+	 * splitmix64 is the recommended way to expand a single seed into xoshiro state
+	 */
+	static uint64_t splitmix64(uint64_t &x) {
+		uint64_t z = (x += 0x9e3779b97f4a7c15);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+		return z ^ (z >> 31);
+	}
+
+	/**
+	 * Seed this thread's generator. The thread id is mixed in as well as random_device,
+	 * so two threads starting in the same tick never share a sequence.
+	 */
+	static void seed() {
+		std::random_device rd;
+		uint64_t x = ((uint64_t)rd() << 32) ^ rd();
+		x ^= std::chrono::steady_clock::now().time_since_epoch().count();
+		x ^= std::hash<std::thread::id>()(std::this_thread::get_id());
+		for (int i = 0; i < 4; ++i) {
+			state.s[i] = splitmix64(x);
+		}
+		state.seeded = true;
+	}
+
+	uint64_t next() {
+		if (!state.seeded) {
+			seed();
+		}
+		uint64_t* s = state.s;
+		const uint64_t result = rotl(s[1] * 5, 7) * 9;
+		const uint64_t t = s[1] << 17;
+		s[2] ^= s[0];
+		s[3] ^= s[1];
+		s[1] ^= s[2];
+		s[0] ^= s[3];
+		s[2] ^= t;
+		s[3] = rotl(s[3], 45);
+		return result;
+	}
+
+	int range(int min, int max) {
+		if (max <= min) {
+			return min;
+		}
+		uint64_t span = (uint64_t)((int64_t)max - (int64_t)min + 1);
+		if (span > UINT32_MAX) {
+			/* The whole range of int, any 32 bits will do */
+			return (int)(uint32_t)(next() >> 32);
+		}
+		/* Lemire's multiply-shift. This is cheaper than modulo, and rejecting the few low
+		 * products below 2^32 % span removes the bias that multiply-shift alone would have.
+		 */
+		uint32_t s = (uint32_t)span;
+		uint64_t m = (next() >> 32) * s;
+		if ((uint32_t)m < s) {
+			uint32_t threshold = -s % s;
+			while ((uint32_t)m < threshold) {
+				m = (next() >> 32) * s;
+			}
+		}
+		return min + (int)(m >> 32);
+	}
+};
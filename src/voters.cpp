@@ -0,0 +1,51 @@
+/************************************************************************************
+ * 
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+#include <sporks/voters.h>
+
+VoterIndex::VoterIndex() : refreshed(0)
+{
+}
+
+void VoterIndex::Replace(std::unordered_map<int64_t, time_t> &voters)
+{
+	std::lock_guard<std::mutex> voters_lock(voters_mutex);
+	expiries.swap(voters);
+	refreshed = time(NULL);
+}
+
+bool VoterIndex::Fresh()
+{
+	std::lock_guard<std::mutex> voters_lock(voters_mutex);
+	return time(NULL) - refreshed <= voter_index_max_age;
+}
+
+bool VoterIndex::HasVoted(int64_t snowflake_id)
+{
+	std::lock_guard<std::mutex> voters_lock(voters_mutex);
+	auto v = expiries.find(snowflake_id);
+	return v != expiries.end() && v->second > time(NULL);
+}
+
+size_t VoterIndex::Size()
+{
+	std::lock_guard<std::mutex> voters_lock(voters_mutex);
+	return expiries.size();
+}
@@ -0,0 +1,330 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************
+ *
+ * facttool: bulk import and export of the infobot table, without going through the bot.
+ *
+ * Facts are stored one per line as six tab separated fields:
+ *
+ *   key_word <TAB> word <TAB> value <TAB> setby <TAB> whenset <TAB> locked
+ *
+ * Backslash, tab, carriage return and newline within a field are written as \\, \t, \r
+ * and \n, so any fact survives a round trip. Use "-" as the filename for stdin/stdout.
+ *
+ * Export streams the table from the server a row at a time, so it uses the same small
+ * amount of memory however many facts there are. Import sends multi-row inserts, many
+ * per transaction, which is far faster than one upsert per fact.
+ *
+ ************************************************************************************/
+
+#include <nlohmann/json.hpp>
+#include <sporks/database.h>
+#include <sporks/stringops.h>
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <cstdio>
+#include <getopt.h>
+
+using json = nlohmann::json;
+
+/* Default number of facts per INSERT statement */
+const uint32_t default_batch_rows = 1000;
+
+/* Default number of facts per transaction */
+const uint32_t default_transaction_rows = 50000;
+
+/* Flush a batch early if its statement grows beyond this, to stay well under max_allowed_packet */
+const size_t max_statement_bytes = 4 * 1024 * 1024;
+
+/* How often to print progress, in rows */
+const uint64_t progress_rows = 100000;
+
+const std::string fact_columns = "key_word, word, value, setby, whenset, locked";
+
+/**
+ * Escape a field for the line format
+ */
+std::string escape_field(const std::string &in)
+{
+	std::string out;
+	out.reserve(in.length());
+	for (char c : in) {
+		switch (c) {
+			case '\\': out += "\\\\"; break;
+			case '\t': out += "\\t"; break;
+			case '\r': out += "\\r"; break;
+			case '\n': out += "\\n"; break;
+			default: out += c; break;
+		}
+	}
+	return out;
+}
+
+/**
+ * Split a line into fields and unescape them. Returns false if the line is malformed.
+ */
+bool split_fields(const std::string &line, std::vector<std::string> &fields)
+{
+	fields.clear();
+	fields.emplace_back();
+	for (size_t i = 0; i < line.length(); ++i) {
+		char c = line[i];
+		if (c == '\t') {
+			fields.emplace_back();
+		} else if (c == '\\') {
+			if (++i >= line.length()) {
+				return false;
+			}
+			switch (line[i]) {
+				case '\\': fields.back() += '\\'; break;
+				case 't': fields.back() += '\t'; break;
+				case 'r': fields.back() += '\r'; break;
+				case 'n': fields.back() += '\n'; break;
+				default: return false;
+			}
+		} else {
+			fields.back() += c;
+		}
+	}
+	return fields.size() == 6;
+}
+
+double elapsed_since(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void report(const char* what, uint64_t rows, std::chrono::steady_clock::time_point start)
+{
+	double secs = elapsed_since(start);
+	fprintf(stderr, "%s %lu facts in %.2fs (%.0f facts/sec)\n", what, (unsigned long)rows, secs, secs > 0 ? rows / secs : 0);
+}
+
+/**
+ * Dump every fact to the output stream in primary key order
+ */
+int export_facts(std::ostream &out)
+{
+	uint64_t rows = 0;
+	auto start = std::chrono::steady_clock::now();
+	bool ok = db::query_each("SELECT " + fact_columns + " FROM infobot ORDER BY key_word", {}, [&](const db::row &r) {
+		out << escape_field(r.at("key_word")) << '\t' << escape_field(r.at("word")) << '\t' << escape_field(r.at("value")) << '\t'
+			<< escape_field(r.at("setby")) << '\t' << r.at("whenset") << '\t' << r.at("locked") << '\n';
+		if (++rows % progress_rows == 0) {
+			report("Exported", rows, start);
+		}
+		return out.good();
+	});
+	out.flush();
+	if (!ok || !out.good()) {
+		std::cerr << "Export failed: " << (ok ? std::string("write error") : db::error()) << "\n";
+		return 3;
+	}
+	report("Exported", rows, start);
+	return 0;
+}
+
+/**
+ * Send one multi-row upsert. Keys are lowercased exactly as set_def() does.
+ */
+bool flush_batch(const std::string &values, const db::paramlist &params)
+{
+	if (params.empty()) {
+		return true;
+	}
+	return db::execute("INSERT INTO infobot (" + fact_columns + ") VALUES " + values +
+		" ON DUPLICATE KEY UPDATE word = VALUES(word), value = VALUES(value), setby = VALUES(setby), whenset = VALUES(whenset), locked = VALUES(locked)", params);
+}
+
+/**
+ * Load facts from the input stream, replacing any existing facts with the same key
+ */
+int import_facts(std::istream &in, uint32_t batch_rows, uint32_t transaction_rows)
+{
+	std::string line;
+	std::vector<std::string> fields;
+	std::string values;
+	db::paramlist params;
+	size_t statement_bytes = 0;
+	uint64_t rows = 0, batched = 0, lineno = 0, skipped = 0, in_transaction = 0;
+	auto start = std::chrono::steady_clock::now();
+
+	params.reserve(batch_rows * 6);
+	db::query("START TRANSACTION", {});
+
+	while (std::getline(in, line)) {
+		lineno++;
+		if (!line.empty() && line.back() == '\r') {
+			line.pop_back();
+		}
+		if (line.empty()) {
+			continue;
+		}
+		if (!split_fields(line, fields)) {
+			std::cerr << "Line " << lineno << ": expected six tab separated fields, skipped\n";
+			skipped++;
+			continue;
+		}
+
+		values.append(batched ? ",('?','?','?','?',?,?)" : "('?','?','?','?',?,?)");
+		params.emplace_back(lowercase(fields[0]));
+		params.emplace_back(fields[1]);
+		params.emplace_back(fields[2]);
+		params.emplace_back(fields[3]);
+		params.emplace_back(from_string<uint64_t>(fields[4], std::dec));
+		params.emplace_back(fields[5] == "1");
+		for (int f = 0; f < 4; ++f) {
+			statement_bytes += fields[f].length() * 2;
+		}
+		batched++;
+
+		if (batched >= batch_rows || statement_bytes >= max_statement_bytes) {
+			if (!flush_batch(values, params)) {
+				std::cerr << "Import failed near line " << lineno << ": " << db::error() << "\n";
+				db::query("ROLLBACK", {});
+				return 3;
+			}
+			rows += batched;
+			in_transaction += batched;
+			uint64_t before = rows - batched;
+			if (rows / progress_rows != before / progress_rows) {
+				report("Imported", rows, start);
+			}
+			if (in_transaction >= transaction_rows) {
+				db::query("COMMIT", {});
+				db::query("START TRANSACTION", {});
+				in_transaction = 0;
+			}
+			values.clear();
+			params.clear();
+			batched = statement_bytes = 0;
+		}
+	}
+
+	if (!flush_batch(values, params)) {
+		std::cerr << "Import failed near line " << lineno << ": " << db::error() << "\n";
+		db::query("ROLLBACK", {});
+		return 3;
+	}
+	rows += batched;
+	db::query("COMMIT", {});
+
+	report("Imported", rows, start);
+	if (skipped) {
+		std::cerr << skipped << " malformed lines skipped\n";
+	}
+	return 0;
+}
+
+void usage(const char* name)
+{
+	std::cerr << "Usage: " << name << " [-config <file>] [-batch <rows>] [-transaction <rows>] import|export <file>\n\n";
+	std::cerr << "-config:      Configuration file to read database details from, default ../config.json\n";
+	std::cerr << "-batch:       Facts per INSERT statement when importing, default " << default_batch_rows << "\n";
+	std::cerr << "-transaction: Facts per transaction when importing, default " << default_transaction_rows << "\n";
+	std::cerr << "<file>:       Fact file to read or write, or - for stdin/stdout\n";
+	exit(1);
+}
+
+int main(int argc, char** argv)
+{
+	std::string configname = "../config.json";
+	uint32_t batch_rows = default_batch_rows;
+	uint32_t transaction_rows = default_transaction_rows;
+
+	struct option longopts[] =
+	{
+		{ "config",		required_argument,	nullptr,	'c' },
+		{ "batch",		required_argument,	nullptr,	'b' },
+		{ "transaction",	required_argument,	nullptr,	't' },
+		{ 0, 0, 0, 0 }
+	};
+
+	int index;
+	int arg;
+	opterr = 0;
+	while ((arg = getopt_long_only(argc, argv, "", longopts, &index)) != -1) {
+		switch (arg) {
+			case 'c':
+				configname = optarg;
+			break;
+			case 'b':
+				batch_rows = std::max(1u, from_string<uint32_t>(optarg, std::dec));
+			break;
+			case 't':
+				transaction_rows = std::max(1u, from_string<uint32_t>(optarg, std::dec));
+			break;
+			default:
+				usage(argv[0]);
+			break;
+		}
+	}
+
+	if (argc - optind != 2) {
+		usage(argv[0]);
+	}
+	std::string command = argv[optind];
+	std::string filename = argv[optind + 1];
+	if (command != "import" && command != "export") {
+		usage(argv[0]);
+	}
+
+	json configdocument;
+	std::ifstream configfile(configname);
+	if (!configfile.good()) {
+		std::cerr << "Can't open " << configname << "\n";
+		exit(2);
+	}
+	configfile >> configdocument;
+
+	if (!db::connect(configdocument["dbhost"].get<std::string>(), configdocument["dbuser"].get<std::string>(), configdocument["dbpass"].get<std::string>(),
+		configdocument["dbname"].get<std::string>(), from_string<uint32_t>(configdocument["dbport"].get<std::string>(), std::dec))) {
+		std::cerr << "Database connection failed\n";
+		exit(2);
+	}
+
+	int rv;
+	if (command == "export") {
+		if (filename == "-") {
+			rv = export_facts(std::cout);
+		} else {
+			std::ofstream out(filename, std::ios::out | std::ios::trunc | std::ios::binary);
+			if (!out.good()) {
+				std::cerr << "Can't open " << filename << " for writing\n";
+				exit(2);
+			}
+			rv = export_facts(out);
+		}
+	} else {
+		if (filename == "-") {
+			rv = import_facts(std::cin, batch_rows, transaction_rows);
+		} else {
+			std::ifstream in(filename, std::ios::in | std::ios::binary);
+			if (!in.good()) {
+				std::cerr << "Can't open " << filename << " for reading\n";
+				exit(2);
+			}
+			rv = import_facts(in, batch_rows, transaction_rows);
+		}
+	}
+
+	db::close();
+	return rv;
+}
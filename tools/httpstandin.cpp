@@ -0,0 +1,167 @@
+/************************************************************************************
+ *
+ * Sporks, the learning, scriptable Discord bot!
+ *
+ * Copyright 2019 Craig Edwards <support@sporks.gg>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************
+ *
+ * httpstandin: a local HTTP server which stands in for the websites scripts fetch with get()
+ * and post(), for trying out the JS module's HTTP client without going to the internet.
+ * Point a script at http://127.0.0.1:<port>/... and use these paths:
+ *
+ *   /echo             Responds with the method and the request body
+ *   /status/<code>    Responds with the given status code
+ *   /redirect/<n>     Redirects n times before responding
+ *   /bytes/<n>        Responds with n bytes of data
+ *   /delay/<ms>       Waits the given number of milliseconds before responding
+ *   /chunked          Responds with a chunked body
+ *   /json             Responds with a small JSON document
+ *
+ * Each connection is handled by its own thread, and is closed after one response.
+ *
+ ************************************************************************************/
+
+#include <asio.hpp>
+#include <sporks/stringops.h>
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <getopt.h>
+
+using asio::ip::tcp;
+
+const uint16_t default_port = 8089;
+
+/* Largest request we'll read, the client limits POST bodies to 256k */
+const size_t max_request = 512 * 1024;
+
+std::string response(uint32_t status, const std::string &body, const std::string &extra_headers = "")
+{
+	return "HTTP/1.1 " + std::to_string(status) + " Stand-in\r\nContent-Type: text/plain\r\nContent-Length: " + std::to_string(body.length()) +
+		"\r\nConnection: close\r\n" + extra_headers + "\r\n" + body;
+}
+
+/**
+ * Read one request: the head, then as much body as Content-Length says
+ */
+bool read_request(tcp::socket &socket, std::string &method, std::string &path, std::string &body)
+{
+	std::string request;
+	char buffer[4096];
+	asio::error_code ec;
+	size_t head_end;
+	while ((head_end = request.find("\r\n\r\n")) == std::string::npos) {
+		size_t length = socket.read_some(asio::buffer(buffer), ec);
+		if (ec || request.length() > max_request) {
+			return false;
+		}
+		request.append(buffer, length);
+	}
+
+	size_t content_length = 0;
+	std::string head = lowercase(request.substr(0, head_end));
+	size_t cl = head.find("\r\ncontent-length:");
+	if (cl != std::string::npos) {
+		content_length = from_string<size_t>(trim(head.substr(cl + 17, head.find("\r\n", cl + 2) - cl - 17)), std::dec);
+	}
+	while (request.length() < head_end + 4 + content_length && request.length() < max_request) {
+		size_t length = socket.read_some(asio::buffer(buffer), ec);
+		if (ec) {
+			return false;
+		}
+		request.append(buffer, length);
+	}
+
+	size_t space1 = request.find(' ');
+	size_t space2 = request.find(' ', space1 + 1);
+	method = request.substr(0, space1);
+	path = request.substr(space1 + 1, space2 - space1 - 1);
+	body = request.substr(head_end + 4);
+	return true;
+}
+
+void handle(tcp::socket socket)
+{
+	std::string method, path, body, out;
+	if (!read_request(socket, method, path, body)) {
+		return;
+	}
+
+	size_t slash = path.find('/', 1);
+	std::string route = path.substr(0, slash);
+	std::string arg = (slash == std::string::npos ? "" : path.substr(slash + 1));
+	uint64_t n = arg.empty() ? 0 : from_string<uint64_t>(arg, std::dec);
+
+	if (route == "/echo") {
+		out = response(200, method + "\n" + body);
+	} else if (route == "/status") {
+		out = response(n, "Status " + arg);
+	} else if (route == "/redirect") {
+		out = (n == 0 ? response(200, "Redirected") : response(302, "", "Location: /redirect/" + std::to_string(n - 1) + "\r\n"));
+	} else if (route == "/bytes") {
+		out = response(200, std::string(n, 'x'));
+	} else if (route == "/delay") {
+		std::this_thread::sleep_for(std::chrono::milliseconds(n));
+		out = response(200, "Delayed " + arg + "ms");
+	} else if (route == "/chunked") {
+		out = "HTTP/1.1 200 Stand-in\r\nTransfer-Encoding: chunked\r\nConnection: close\r\n\r\n5\r\nHello\r\n7\r\n, world\r\n0\r\n\r\n";
+	} else if (route == "/json") {
+		out = "HTTP/1.1 200 Stand-in\r\nContent-Type: application/json\r\nConnection: close\r\n\r\n{\"name\":\"sporks\",\"list\":[1,2,3]}";
+	} else {
+		out = response(404, "Not found");
+	}
+
+	std::cout << method << " " << path << " => " << out.substr(9, 3) << "\n";
+	asio::error_code ec;
+	asio::write(socket, asio::buffer(out), ec);
+	socket.shutdown(tcp::socket::shutdown_both, ec);
+}
+
+int main(int argc, char** argv)
+{
+	uint16_t port = default_port;
+
+	struct option longopts[] =
+	{
+		{ "port",	required_argument,	nullptr,	'p' },
+		{ 0, 0, 0, 0 }
+	};
+
+	int index;
+	int arg;
+	opterr = 0;
+	while ((arg = getopt_long_only(argc, argv, "", longopts, &index)) != -1) {
+		switch (arg) {
+			case 'p':
+				port = from_string<uint16_t>(optarg, std::dec);
+			break;
+			default:
+				std::cerr << "Usage: " << argv[0] << " [-port <port>]\n";
+				exit(1);
+			break;
+		}
+	}
+
+	asio::io_context io;
+	tcp::acceptor acceptor(io, tcp::endpoint(asio::ip::make_address("127.0.0.1"), port));
+	std::cout << "Listening on http://127.0.0.1:" << port << "/\n";
+	while (true) {
+		tcp::socket socket(io);
+		acceptor.accept(socket);
+		std::thread(handle, std::move(socket)).detach();
+	}
+	return 0;
+}